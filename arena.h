@@ -0,0 +1,214 @@
+/*
+ *  Copyright (C) 2020-present  Mikael Lund (github.com/mlund/cpptricks)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+
+namespace Arena {
+
+/**
+ * @brief Monotonic arena for short-lived scratch memory, usable as a `std::pmr::memory_resource`
+ *
+ * Allocation bumps a pointer into the current block; deallocation is a no-op. Memory is
+ * reclaimed all at once with `reset()`, or back to a `mark()` with `rewind()`, but the blocks
+ * are kept and reused so that a loop doing the same allocations every iteration stops calling
+ * `malloc` after the first. Blocks are obtained from `upstream`, doubling in size.
+ * An arena must only be used by one thread at a time; see `local()`. The parallel pair drivers
+ * run each chunk within a `scope` of the executing thread's `local()` arena, so kernels may take
+ * short-lived scratch from it without a scope of their own.
+ *
+ * Example:
+ *
+ * ~~~ cpp
+ * Arena::arena arena;
+ * for (int step = 0; step < steps; step++) {
+ *     std::pmr::vector<Eigen::Vector3d> forces(n, &arena);
+ *     ...
+ *     arena.reset(); // after `forces` is gone
+ * }
+ * ~~~
+ */
+class arena : public std::pmr::memory_resource {
+  public:
+    /** Position in the arena to rewind to */
+    struct marker {
+        std::size_t block = 0, offset = 0;
+    };
+
+    explicit arena(std::size_t initial_size = 64 * 1024,
+                   std::pmr::memory_resource *upstream = std::pmr::new_delete_resource())
+        : initial_size(std::max<std::size_t>(initial_size, 64)), upstream(upstream) {}
+    arena(const arena &) = delete;
+    arena &operator=(const arena &) = delete;
+    ~arena() override { release(); }
+
+    marker mark() const { return position; }
+
+    /** Reclaim everything allocated after `m` was taken */
+    void rewind(marker m) { position = m; }
+
+    /** Reclaim all allocations but keep the blocks for reuse */
+    void reset() { position = {}; }
+
+    /** Return all blocks to the upstream resource */
+    void release() {
+        for (auto &b : blocks)
+            upstream->deallocate(b.data, b.size, alignof(std::max_align_t));
+        blocks.clear();
+        position = {};
+    }
+
+    /** Total size of all blocks */
+    std::size_t capacity() const {
+        std::size_t size = 0;
+        for (auto &b : blocks)
+            size += b.size;
+        return size;
+    }
+
+  private:
+    struct block {
+        std::byte *data;
+        std::size_t size;
+    };
+    std::size_t initial_size;
+    std::pmr::memory_resource *upstream;
+    std::vector<block> blocks;
+    marker position; // next free byte
+
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+        while (position.block < blocks.size()) {
+            auto &b = blocks[position.block];
+            auto address = reinterpret_cast<std::uintptr_t>(b.data) + position.offset;
+            auto offset = position.offset + (alignment - address % alignment) % alignment;
+            if (offset + bytes <= b.size) {
+                position.offset = offset + bytes;
+                return b.data + offset;
+            }
+            if (position.offset == 0)
+                break; // block is too small even when empty; insert a larger one here
+            position = {position.block + 1, 0};
+        }
+        auto size = std::max({initial_size, blocks.empty() ? 0 : 2 * blocks.back().size, bytes + alignment});
+        auto data = static_cast<std::byte *>(upstream->allocate(size, alignof(std::max_align_t)));
+        blocks.insert(blocks.begin() + position.block, block{data, size});
+        position.offset = 0;
+        return do_allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void *, std::size_t, std::size_t) override {}
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override { return this == &other; }
+};
+
+/** Largest allocation, in bytes, that `scope::resource(bytes)` places in the arena */
+inline constexpr std::size_t retain_limit = std::size_t(16) << 20;
+
+/** Arena of the calling thread */
+inline arena &local() {
+    thread_local arena a;
+    return a;
+}
+
+/**
+ * @brief Rewinds an arena to where it was when the scope was entered
+ *
+ * Scopes may be nested. Everything allocated within the scope must be destroyed before it ends.
+ *
+ * ~~~ cpp
+ * {
+ *     Arena::scope scope; // thread local arena
+ *     std::pmr::vector<double> tmp(n, scope.resource());
+ * }
+ * ~~~
+ */
+class scope {
+    arena &a;
+    arena::marker m;
+
+  public:
+    explicit scope(arena &a = local()) : a(a), m(a.mark()) {}
+    scope(const scope &) = delete;
+    scope &operator=(const scope &) = delete;
+    ~scope() { a.rewind(m); }
+    arena *resource() const { return &a; }
+
+    /**
+     * @brief Resource for a buffer of `bytes`: the arena up to `retain_limit`, the heap above
+     *
+     * Arena blocks are kept until released, so a single large buffer would otherwise stay
+     * allocated for the lifetime of the thread.
+     */
+    std::pmr::memory_resource *resource(std::size_t bytes) const {
+        return bytes <= retain_limit ? static_cast<std::pmr::memory_resource *>(&a) : std::pmr::new_delete_resource();
+    }
+};
+
+} // namespace Arena
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+#include <thread>
+
+TEST_CASE("arena") {
+    Arena::arena arena(256);
+    auto p1 = arena.allocate(10, 1);
+    auto p2 = arena.allocate(8, 64);
+    CHECK(reinterpret_cast<std::uintptr_t>(p2) % 64 == 0);
+    CHECK(static_cast<std::byte *>(p2) >= static_cast<std::byte *>(p1) + 10);
+    auto capacity = arena.capacity();
+
+    arena.reset(); // memory is reused
+    CHECK(arena.allocate(10, 1) == p1);
+    CHECK(arena.capacity() == capacity);
+
+    auto m = arena.mark();
+    auto p3 = arena.allocate(100, 8);
+    arena.rewind(m);
+    CHECK(arena.allocate(100, 8) == p3);
+
+    auto large = arena.allocate(10000, 16); // larger than any block
+    CHECK(reinterpret_cast<std::uintptr_t>(large) % 16 == 0);
+    CHECK(arena.capacity() >= capacity + 10000);
+
+    SUBCASE("pmr containers") {
+        for (int step = 0; step < 3; step++) {
+            Arena::scope scope(arena);
+            std::pmr::vector<double> v(scope.resource());
+            for (int i = 0; i < 1000; i++)
+                v.push_back(i);
+            CHECK(v.back() == 999);
+            capacity = step == 0 ? arena.capacity() : capacity;
+            CHECK(arena.capacity() == capacity); // no new blocks after the first iteration
+        }
+    }
+
+    SUBCASE("large buffers bypass the arena") {
+        Arena::scope scope(arena);
+        CHECK(scope.resource(Arena::retain_limit) == &arena);
+        CHECK(scope.resource(Arena::retain_limit + 1) == std::pmr::new_delete_resource());
+    }
+
+    SUBCASE("thread local arenas") {
+        Arena::arena *other = nullptr;
+        std::thread([&] { other = &Arena::local(); }).join();
+        CHECK(other != &Arena::local());
+    }
+}
+#endif
@@ -0,0 +1,620 @@
+#include <benchmark/benchmark.h>
+#include <array>
+#include <cmath>
+#include <execution>
+#include <list>
+#include <random>
+#include <vector>
+
+#include "arena.h"
+#include "invsqrt.h"
+#include "pairwise_iterator.h"
+#include "pbc_distance.h"
+#include "soa_vector.h"
+#include "stl_eigen_facade.h"
+#include "work_stealing.h"
+#include "masked_pairs.h"
+#include "pair_table.h"
+
+namespace {
+
+using namespace PairwiseIterator;
+
+template <typename T> std::vector<T> random_values(std::size_t n) {
+    std::mt19937 engine;
+    std::uniform_real_distribution<T> dist(0.01, 100.0);
+    std::vector<T> v(n);
+    for (auto &x : v)
+        x = dist(engine);
+    return v;
+}
+
+template <typename T> void std_sqrt(benchmark::State &state) {
+    auto x = random_values<T>(state.range(0));
+    std::vector<T> y(x.size());
+    for (auto _ : state) {
+        for (std::size_t i = 0; i < x.size(); i++)
+            y[i] = T(1) / std::sqrt(x[i]);
+        benchmark::DoNotOptimize(y.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * x.size());
+}
+
+template <typename T, char iterations> void inv_sqrt_scalar(benchmark::State &state) {
+    auto x = random_values<T>(state.range(0));
+    std::vector<T> y(x.size());
+    for (auto _ : state) {
+        for (std::size_t i = 0; i < x.size(); i++)
+            y[i] = inv_sqrt<T, iterations>(x[i]);
+        benchmark::DoNotOptimize(y.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * x.size());
+}
+
+template <typename T, char iterations> void inv_sqrt_batch(benchmark::State &state) {
+    auto x = random_values<T>(state.range(0));
+    std::vector<T> y(x.size());
+    for (auto _ : state) {
+        inv_sqrt<T, iterations>(x.data(), x.data() + x.size(), y.data());
+        benchmark::DoNotOptimize(y.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * x.size());
+}
+
+template <typename T, char iterations> void rsqrt_batch(benchmark::State &state) {
+    auto x = random_values<T>(state.range(0));
+    std::vector<T> y(x.size());
+    for (auto _ : state) {
+        rsqrt<T, iterations>(x.data(), x.data() + x.size(), y.data());
+        benchmark::DoNotOptimize(y.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * x.size());
+}
+
+/** Call the kernel for a given instruction set directly, bypassing the runtime dispatch */
+template <typename T, char iterations> void inv_sqrt_isa(benchmark::State &state) {
+    auto isa = static_cast<InvSqrt::isa>(state.range(1));
+    if (not InvSqrt::supported(isa)) {
+        state.SkipWithError("instruction set not supported");
+        return;
+    }
+    auto kernel = InvSqrt::magic_kernel<iterations, T>(isa);
+    auto x = random_values<T>(state.range(0));
+    std::vector<T> y(x.size());
+    for (auto _ : state) {
+        kernel(x.data(), y.data(), x.size());
+        benchmark::DoNotOptimize(y.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * x.size());
+    state.SetLabel(InvSqrt::name(isa));
+}
+
+void isa_arguments(benchmark::internal::Benchmark *b) {
+    for (auto isa : {InvSqrt::isa::sse2, InvSqrt::isa::avx2, InvSqrt::isa::avx512, InvSqrt::isa::neon})
+        b->Args({1 << 16, static_cast<long>(isa)});
+}
+
+/*
+ * Pair loops. Each benchmark sums the same pair function over all unique pairs (or all pairs
+ * between two containers) so that any difference is the cost of the iteration itself.
+ */
+
+inline double pair_function(double a, double b) { return a * b; }
+
+/** Hand-written reference: double loop over vector indices */
+void pairs_index_loop(benchmark::State &state) {
+    auto v = random_values<double>(state.range(0));
+    for (auto _ : state) {
+        double sum = 0;
+        for (std::size_t i = 0; i < v.size(); i++)
+            for (std::size_t j = i + 1; j < v.size(); j++)
+                sum += pair_function(v[i], v[j]);
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * v.size() * (v.size() - 1) / 2);
+}
+
+/** Hand-written reference: double loop over container iterators, e.g. for `std::list` */
+template <class Container> void pairs_iterator_loop(benchmark::State &state) {
+    auto x = random_values<double>(state.range(0));
+    Container v(x.begin(), x.end());
+    for (auto _ : state) {
+        double sum = 0;
+        for (auto i = v.begin(); i != v.end(); ++i)
+            for (auto j = std::next(i); j != v.end(); ++j)
+                sum += pair_function(*i, *j);
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * x.size() * (x.size() - 1) / 2);
+}
+
+template <class Container, std::size_t Tile = 0> void pairs_internal_pairs(benchmark::State &state) {
+    auto x = random_values<double>(state.range(0));
+    Container v(x.begin(), x.end());
+    for (auto _ : state) {
+        double sum = 0;
+        for (auto [a, b] : internal_pairs(v, tile<Tile>))
+            sum += pair_function(a, b);
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * x.size() * (x.size() - 1) / 2);
+}
+
+void product_index_loop(benchmark::State &state) {
+    auto v1 = random_values<double>(state.range(0));
+    auto v2 = random_values<double>(state.range(0));
+    for (auto _ : state) {
+        double sum = 0;
+        for (std::size_t i = 0; i < v1.size(); i++)
+            for (std::size_t j = 0; j < v2.size(); j++)
+                sum += pair_function(v1[i], v2[j]);
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * v1.size() * v2.size());
+}
+
+template <std::size_t Tile = 0> void product_cartesian_product(benchmark::State &state) {
+    auto v1 = random_values<double>(state.range(0));
+    auto v2 = random_values<double>(state.range(0));
+    for (auto _ : state) {
+        double sum = 0;
+        for (auto [a, b] : cartesian_product(v1.begin(), v1.end(), v2.begin(), v2.end(), tile<Tile>))
+            sum += pair_function(a, b);
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * v1.size() * v2.size());
+}
+
+/** Site-site pairs within small rigid molecules of `Sites` sites, with and without unrolling */
+template <std::size_t Sites, bool unrolled> void pairs_static(benchmark::State &state) {
+    auto x = random_values<double>(state.range(0) * Sites);
+    std::vector<std::array<double, Sites>> molecules(state.range(0));
+    for (std::size_t m = 0; m < molecules.size(); m++)
+        std::copy_n(x.begin() + m * Sites, Sites, molecules[m].begin());
+    for (auto _ : state) {
+        double sum = 0;
+        for (auto &sites : molecules) {
+            if constexpr (unrolled)
+                static_pairs<Sites>::for_each(sites, [&](double a, double b) { sum += pair_function(a, b); });
+            else
+                for (auto [a, b] : internal_pairs(sites))
+                    sum += pair_function(a, b);
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * molecules.size() * static_pairs<Sites>::size);
+}
+
+/** Pairs of active particles with half the slots inactive, by testing in the loop or with `masked_pairs` */
+template <bool masked> void pairs_active(benchmark::State &state) {
+    auto v = random_values<double>(state.range(0));
+    active_mask active(v.size());
+    for (std::size_t i = 0; i < v.size(); i++)
+        active.set(i, (i * 2654435761u) % 4 < 2); // half the slots empty, scattered
+    masked_pairs pairs(v, active);
+    for (auto _ : state) {
+        double sum = 0;
+        if constexpr (masked)
+            for (auto [a, b] : pairs)
+                sum += pair_function(a, b);
+        else
+            for (std::size_t i = 0; i < v.size(); i++)
+                for (std::size_t j = i + 1; j < v.size(); j++)
+                    if (active.test(i) and active.test(j))
+                        sum += pair_function(v[i], v[j]);
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * pairs.size());
+}
+
+/** Energy change of a single particle move: all pairs from scratch versus the cached pair table */
+template <bool cached> void move_energy(benchmark::State &state) {
+    auto v = random_values<double>(state.range(0));
+    pair_table<> table(v, pair_function);
+    auto total = [&] {
+        double sum = 0;
+        for (auto [a, b] : internal_pairs(v))
+            sum += pair_function(a, b);
+        return sum;
+    };
+    double u = total();
+    std::size_t k = 0;
+    for (auto _ : state) {
+        k = (k + 7919) % v.size();
+        v[k] += 0.001;
+        if constexpr (cached) {
+            benchmark::DoNotOptimize(table.trial(v, k, pair_function));
+            table.accept();
+        } else {
+            const double next = total();
+            benchmark::DoNotOptimize(next - u);
+            u = next;
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+/** Short-lived per-iteration temporaries from the heap versus from the thread local arena */
+void scratch_heap(benchmark::State &state) {
+    for (auto _ : state) {
+        std::vector<double> forces(state.range(0), 0.0);
+        benchmark::DoNotOptimize(forces.data());
+    }
+}
+
+void scratch_arena(benchmark::State &state) {
+    for (auto _ : state) {
+        Arena::scope scope;
+        std::pmr::vector<double> forces(state.range(0), 0.0, scope.resource());
+        benchmark::DoNotOptimize(forces.data());
+    }
+}
+
+/*
+ * Reductions over a data member in a vector of structures: raw loops versus `asEigenMatrix()`
+ * and `asEigenVector()` views.
+ */
+
+struct Particle {
+    Eigen::Vector3d pos;
+    double charge;
+};
+
+std::vector<Particle> random_particles(std::size_t n) {
+    auto x = random_values<double>(4 * n);
+    std::vector<Particle> v(n);
+    for (std::size_t i = 0; i < n; i++)
+        v[i] = {{x[4 * i], x[4 * i + 1], x[4 * i + 2]}, x[4 * i + 3]};
+    return v;
+}
+
+void charge_sum_loop(benchmark::State &state) {
+    auto v = random_particles(state.range(0));
+    for (auto _ : state) {
+        double sum = 0;
+        for (auto &p : v)
+            sum += p.charge;
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * v.size());
+}
+
+void charge_sum_eigen(benchmark::State &state) {
+    auto v = random_particles(state.range(0));
+    for (auto _ : state) {
+        double sum = asEigenVector(v.begin(), v.end(), &Particle::charge).sum();
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * v.size());
+}
+
+void position_sum_loop(benchmark::State &state) {
+    auto v = random_particles(state.range(0));
+    for (auto _ : state) {
+        Eigen::Vector3d sum = Eigen::Vector3d::Zero();
+        for (auto &p : v)
+            sum += p.pos;
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * v.size());
+}
+
+void position_sum_eigen(benchmark::State &state) {
+    auto v = random_particles(state.range(0));
+    for (auto _ : state) {
+        Eigen::Array<double, 1, 3> sum = asEigenMatrix(v.begin(), v.end(), &Particle::pos).colwise().sum();
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * v.size());
+}
+
+void position_sum_aligned(benchmark::State &state) {
+    auto aos = random_particles(state.range(0));
+    std::vector<padded<Particle, 32>> v(aos.begin(), aos.end());
+    for (auto _ : state) {
+        Eigen::Array<double, 1, 3> sum = asAlignedEigenMatrix(v.begin(), v.end(), &Particle::pos).colwise().sum();
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * v.size());
+}
+
+void squared_norm_eigen(benchmark::State &state) {
+    auto v = random_particles(state.range(0));
+    for (auto _ : state) {
+        double sum = asEigenMatrix(v.begin(), v.end(), &Particle::pos).rowwise().squaredNorm().sum();
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * v.size());
+}
+
+void squared_norm_aligned(benchmark::State &state) {
+    auto aos = random_particles(state.range(0));
+    std::vector<padded<Particle, 32>> v(aos.begin(), aos.end());
+    for (auto _ : state) {
+        double sum = asAlignedEigenMatrix(v.begin(), v.end(), &Particle::pos).rowwise().squaredNorm().sum();
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * v.size());
+}
+
+/** Heavy linear algebra on a member: the N x N matrix of position dot products */
+void gram_strided(benchmark::State &state) {
+    auto v = random_particles(state.range(0));
+    Eigen::MatrixXd gram(v.size(), v.size());
+    for (auto _ : state) {
+        auto m = asEigenMatrix(v.begin(), v.end(), &Particle::pos).matrix();
+        gram.noalias() = m * m.transpose();
+        benchmark::DoNotOptimize(gram.data());
+    }
+    state.SetItemsProcessed(state.iterations() * v.size() * v.size());
+}
+
+void gram_packed(benchmark::State &state) {
+    auto v = random_particles(state.range(0));
+    Eigen::MatrixXd gram(v.size(), v.size());
+    for (auto _ : state) {
+        const packed_view view(v.begin(), v.end(), &Particle::pos);
+        gram.noalias() = view.matrix() * view.matrix().transpose();
+        benchmark::DoNotOptimize(gram.data());
+    }
+    state.SetItemsProcessed(state.iterations() * v.size() * v.size());
+}
+
+void position_sum_soa(benchmark::State &state) {
+    auto aos = random_particles(state.range(0));
+    soa_vector<Particle, &Particle::pos, &Particle::charge> v(aos.begin(), aos.end());
+    for (auto _ : state) {
+        Eigen::Array<double, 1, 3> sum = asEigenMatrix(v, &Particle::pos).colwise().sum();
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * v.size());
+}
+
+/** Lennard-Jones energy of all pairs with positions in SoA columns: index loop versus pair batches */
+void lennard_jones_loop(benchmark::State &state) {
+    auto aos = random_particles(state.range(0));
+    soa_vector<Particle, &Particle::pos> v(aos.begin(), aos.end());
+    auto m = asEigenMatrix(v, &Particle::pos);
+    const double *x = &m(0, 0), *y = &m(0, 1), *z = &m(0, 2);
+    const std::size_t n = v.size();
+    for (auto _ : state) {
+        double u = 0;
+        for (std::size_t i = 0; i < n; i++)
+            for (std::size_t j = i + 1; j < n; j++) {
+                double dx = x[i] - x[j], dy = y[i] - y[j], dz = z[i] - z[j];
+                double r2 = dx * dx + dy * dy + dz * dz;
+                double s6 = 1.0 / (r2 * r2 * r2);
+                u += s6 * s6 - s6;
+            }
+        benchmark::DoNotOptimize(u);
+    }
+    state.SetItemsProcessed(state.iterations() * n * (n - 1) / 2);
+}
+
+template <std::size_t W> void lennard_jones_batches(benchmark::State &state) {
+    auto aos = random_particles(state.range(0));
+    soa_vector<Particle, &Particle::pos> v(aos.begin(), aos.end());
+    auto m = asEigenMatrix(v, &Particle::pos);
+    const double *x = &m(0, 0), *y = &m(0, 1), *z = &m(0, 2);
+    for (auto _ : state) {
+        double u = 0;
+        std::array<double, W> lane_u = {};
+        for (const auto &b : pair_batches<W>(v)) {
+            std::array<double, W> r2;
+            if (b.contiguous) { // same i, consecutive j: broadcast and contiguous loads
+                const double xi = x[b.i[0]], yi = y[b.i[0]], zi = z[b.i[0]];
+                const double *xj = x + b.j[0], *yj = y + b.j[0], *zj = z + b.j[0];
+                for (std::size_t lane = 0; lane < W; lane++) {
+                    double dx = xi - xj[lane], dy = yi - yj[lane], dz = zi - zj[lane];
+                    r2[lane] = dx * dx + dy * dy + dz * dz;
+                }
+            } else
+                for (std::size_t lane = 0; lane < W; lane++) {
+                    double dx = x[b.i[lane]] - x[b.j[lane]];
+                    double dy = y[b.i[lane]] - y[b.j[lane]];
+                    double dz = z[b.i[lane]] - z[b.j[lane]];
+                    r2[lane] = dx * dx + dy * dy + dz * dz;
+                }
+            for (std::size_t lane = 0; lane < W; lane++) { // one accumulator per lane vectorizes
+                double s6 = 1.0 / (r2[lane] * r2[lane] * r2[lane]);
+                lane_u[lane] += b.active(lane) ? s6 * s6 - s6 : 0.0;
+            }
+        }
+        for (auto lane_energy : lane_u)
+            u += lane_energy;
+        benchmark::DoNotOptimize(u);
+    }
+    state.SetItemsProcessed(state.iterations() * v.size() * (v.size() - 1) / 2);
+}
+
+/** Pair forces on all particles: full N x N loop versus Newton's third law with `reduce_pairs_symmetric()` */
+struct Atom {
+    Eigen::Vector3d pos, force = Eigen::Vector3d::Zero();
+};
+
+std::vector<Atom> random_atoms(std::size_t n) {
+    auto particles = random_particles(n);
+    std::vector<Atom> v(n);
+    for (std::size_t i = 0; i < n; i++)
+        v[i].pos = particles[i].pos;
+    return v;
+}
+
+Eigen::Vector3d coulomb_force(const Atom &a, const Atom &b) {
+    Eigen::Vector3d r = a.pos - b.pos;
+    double r2 = r.squaredNorm();
+    return r / (r2 * std::sqrt(r2));
+}
+
+void forces_product(benchmark::State &state) {
+    auto v = random_atoms(state.range(0));
+    for (auto _ : state) {
+        for (std::size_t i = 0; i < v.size(); i++)
+            for (std::size_t j = 0; j < v.size(); j++)
+                if (i != j)
+                    v[i].force += coulomb_force(v[i], v[j]);
+        benchmark::DoNotOptimize(v.data());
+    }
+    state.SetItemsProcessed(state.iterations() * v.size() * (v.size() - 1) / 2);
+}
+
+void forces_symmetric(benchmark::State &state) {
+    auto v = random_atoms(state.range(0));
+    for (auto _ : state) {
+        reduce_pairs_symmetric(v, &Atom::force, coulomb_force);
+        benchmark::DoNotOptimize(v.data());
+    }
+    state.SetItemsProcessed(state.iterations() * v.size() * (v.size() - 1) / 2);
+}
+
+void forces_symmetric_par(benchmark::State &state) {
+    auto v = random_atoms(state.range(0));
+    for (auto _ : state) {
+        reduce_pairs_symmetric(std::execution::par, v, &Atom::force, coulomb_force);
+        benchmark::DoNotOptimize(v.data());
+    }
+    state.SetItemsProcessed(state.iterations() * v.size() * (v.size() - 1) / 2);
+}
+
+/** Pairs within a cutoff in a clustered system: serial loop versus the work-stealing pool, one cell per task */
+std::vector<Atom> clustered_atoms(std::size_t n, double box) {
+    auto v = random_atoms(n);
+    for (auto &a : v)
+        a.pos = {std::pow(a.pos.x(), 4) * box, a.pos.y() * box, a.pos.z() * box}; // dense near x = 0
+    return v;
+}
+
+void cutoff_serial(benchmark::State &state) {
+    auto v = clustered_atoms(state.range(0), 20.0);
+    cutoff_pairs pairs(v, &Atom::pos, Eigen::Vector3d(20, 20, 20), 2.0);
+    for (auto _ : state) {
+        double sum = 0;
+        for (auto [a, b] : pairs)
+            sum += (a.pos - b.pos).squaredNorm();
+        benchmark::DoNotOptimize(sum);
+    }
+}
+
+void cutoff_pool(benchmark::State &state) {
+    auto v = clustered_atoms(state.range(0), 20.0);
+    cutoff_pairs pairs(v, &Atom::pos, Eigen::Vector3d(20, 20, 20), 2.0);
+    for (auto _ : state) {
+        parallel_for_pairs(WorkStealing::pool::global(), pairs, [](auto pair) {
+            auto [a, b] = pair;
+            benchmark::DoNotOptimize((a.pos - b.pos).squaredNorm());
+        });
+    }
+}
+
+/** Coulomb energy with minimum image distances in a cubic box: `std::round` loop versus batch kernels */
+void pbc_coulomb_round(benchmark::State &state) {
+    auto aos = random_particles(state.range(0));
+    soa_vector<Particle, &Particle::pos> v(aos.begin(), aos.end());
+    auto m = asEigenMatrix(v, &Particle::pos);
+    const double *x = &m(0, 0), *y = &m(0, 1), *z = &m(0, 2), side = 10.0;
+    const std::size_t n = v.size();
+    for (auto _ : state) {
+        double u = 0;
+        for (std::size_t i = 0; i < n; i++)
+            for (std::size_t j = i + 1; j < n; j++) {
+                double dx = x[i] - x[j], dy = y[i] - y[j], dz = z[i] - z[j];
+                dx -= side * std::round(dx / side);
+                dy -= side * std::round(dy / side);
+                dz -= side * std::round(dz / side);
+                u += 1.0 / std::sqrt(dx * dx + dy * dy + dz * dz);
+            }
+        benchmark::DoNotOptimize(u);
+    }
+    state.SetItemsProcessed(state.iterations() * n * (n - 1) / 2);
+}
+
+template <bool fused> void pbc_coulomb_batches(benchmark::State &state) {
+    auto aos = random_particles(state.range(0));
+    soa_vector<Particle, &Particle::pos> v(aos.begin(), aos.end());
+    auto m = asEigenMatrix(v, &Particle::pos);
+    PeriodicBoundary::cubic box(10.0);
+    std::array<double, 16> r2, inverse_r;
+    for (auto _ : state) {
+        double u = 0;
+        for (const auto &b : pair_batches<16>(v)) {
+            if constexpr (fused)
+                PeriodicBoundary::inverse_distances(box, m, b, r2, inverse_r);
+            else {
+                PeriodicBoundary::squared_distances(box, m, b, r2);
+                for (std::size_t lane = 0; lane < b.width; lane++)
+                    inverse_r[lane] = 1.0 / std::sqrt(r2[lane]);
+            }
+            for (std::size_t lane = 0; lane < b.width; lane++)
+                u += b.active(lane) ? inverse_r[lane] : 0.0;
+        }
+        benchmark::DoNotOptimize(u);
+    }
+    state.SetItemsProcessed(state.iterations() * v.size() * (v.size() - 1) / 2);
+}
+
+} // namespace
+
+BENCHMARK_TEMPLATE(std_sqrt, float)->Range(1 << 8, 1 << 16);
+BENCHMARK_TEMPLATE(std_sqrt, double)->Range(1 << 8, 1 << 16);
+BENCHMARK_TEMPLATE(inv_sqrt_scalar, float, 1)->Range(1 << 8, 1 << 16);
+BENCHMARK_TEMPLATE(inv_sqrt_scalar, double, 2)->Range(1 << 8, 1 << 16);
+BENCHMARK_TEMPLATE(inv_sqrt_batch, float, 1)->Range(1 << 8, 1 << 16);
+BENCHMARK_TEMPLATE(inv_sqrt_batch, float, 2)->Range(1 << 8, 1 << 16);
+BENCHMARK_TEMPLATE(inv_sqrt_batch, double, 2)->Range(1 << 8, 1 << 16);
+BENCHMARK_TEMPLATE(rsqrt_batch, float, 1)->Range(1 << 8, 1 << 16);
+BENCHMARK_TEMPLATE(inv_sqrt_isa, float, 2)->Apply(isa_arguments);
+BENCHMARK_TEMPLATE(inv_sqrt_isa, double, 2)->Apply(isa_arguments);
+
+BENCHMARK(pairs_index_loop)->Range(1 << 6, 1 << 12);
+BENCHMARK_TEMPLATE(pairs_iterator_loop, std::vector<double>)->Range(1 << 6, 1 << 12);
+BENCHMARK_TEMPLATE(pairs_internal_pairs, std::vector<double>)->Range(1 << 6, 1 << 12);
+BENCHMARK_TEMPLATE(pairs_internal_pairs, std::vector<double>, 256)->Range(1 << 6, 1 << 12);
+BENCHMARK_TEMPLATE(pairs_iterator_loop, std::list<double>)->Range(1 << 6, 1 << 12);
+BENCHMARK_TEMPLATE(pairs_internal_pairs, std::list<double>)->Range(1 << 6, 1 << 12);
+BENCHMARK(product_index_loop)->Range(1 << 6, 1 << 12);
+BENCHMARK_TEMPLATE(product_cartesian_product)->Range(1 << 6, 1 << 12);
+BENCHMARK_TEMPLATE(product_cartesian_product, 256)->Range(1 << 6, 1 << 12);
+BENCHMARK_TEMPLATE(pairs_static, 4, false)->Arg(1 << 12);
+BENCHMARK_TEMPLATE(pairs_static, 4, true)->Arg(1 << 12);
+BENCHMARK_TEMPLATE(pairs_static, 8, false)->Arg(1 << 12);
+BENCHMARK_TEMPLATE(pairs_static, 8, true)->Arg(1 << 12);
+BENCHMARK_TEMPLATE(pairs_active, false)->Range(1 << 8, 1 << 12);
+BENCHMARK_TEMPLATE(pairs_active, true)->Range(1 << 8, 1 << 12);
+BENCHMARK_TEMPLATE(move_energy, false)->Range(1 << 8, 1 << 12);
+BENCHMARK_TEMPLATE(move_energy, true)->Range(1 << 8, 1 << 12);
+
+BENCHMARK(lennard_jones_loop)->Range(1 << 8, 1 << 12);
+BENCHMARK_TEMPLATE(lennard_jones_batches, 8)->Range(1 << 8, 1 << 12);
+BENCHMARK_TEMPLATE(lennard_jones_batches, 16)->Range(1 << 8, 1 << 12);
+
+BENCHMARK(forces_product)->Range(1 << 8, 1 << 12)->UseRealTime();
+BENCHMARK(forces_symmetric)->Range(1 << 8, 1 << 12)->UseRealTime();
+BENCHMARK(forces_symmetric_par)->Range(1 << 8, 1 << 12)->UseRealTime();
+
+BENCHMARK(cutoff_serial)->Range(1 << 10, 1 << 14)->UseRealTime();
+BENCHMARK(cutoff_pool)->Range(1 << 10, 1 << 14)->UseRealTime();
+
+BENCHMARK(pbc_coulomb_round)->Range(1 << 8, 1 << 12);
+BENCHMARK_TEMPLATE(pbc_coulomb_batches, false)->Range(1 << 8, 1 << 12);
+BENCHMARK_TEMPLATE(pbc_coulomb_batches, true)->Range(1 << 8, 1 << 12);
+
+BENCHMARK(scratch_heap)->Range(1 << 4, 1 << 16);
+BENCHMARK(scratch_arena)->Range(1 << 4, 1 << 16);
+
+BENCHMARK(charge_sum_loop)->Range(1 << 8, 1 << 18);
+BENCHMARK(charge_sum_eigen)->Range(1 << 8, 1 << 18);
+BENCHMARK(position_sum_loop)->Range(1 << 8, 1 << 18);
+BENCHMARK(position_sum_eigen)->Range(1 << 8, 1 << 18);
+BENCHMARK(position_sum_aligned)->Range(1 << 8, 1 << 18);
+BENCHMARK(position_sum_soa)->Range(1 << 8, 1 << 18);
+BENCHMARK(squared_norm_eigen)->Range(1 << 8, 1 << 18);
+BENCHMARK(squared_norm_aligned)->Range(1 << 8, 1 << 18);
+BENCHMARK(gram_strided)->Range(1 << 6, 1 << 11);
+BENCHMARK(gram_packed)->Range(1 << 6, 1 << 11);
+
+BENCHMARK_MAIN();
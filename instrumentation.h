@@ -0,0 +1,289 @@
+/*
+ *  Copyright (C) 2020-present  Mikael Lund (github.com/mlund/cpptricks)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#if __has_include(<linux/perf_event.h>)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define INSTRUMENTATION_PERF_EVENT
+#endif
+
+/**
+ * @brief Opt-in counters and timings for the parallel pair drivers
+ *
+ * The drivers take an instrument as a last, optional argument whose type is a template parameter.
+ * The default, `disabled`, has empty inline members so that no code is generated. A `recorder`
+ * collects, per thread, the pairs visited, the pairs skipped by a cutoff and the wall time and
+ * cache misses of each chunk. Counting is per chunk, never per pair. Cache misses are read from
+ * `perf_event_open` on Linux where permitted, and reported as unavailable otherwise.
+ *
+ * Example:
+ *
+ * ~~~ cpp
+ * Instrumentation::recorder stats;
+ * parallel_for_pairs(pool, cutoff_pairs(v, &Particle::pos, box, rcut), kernel, grain, stats);
+ * std::cout << stats.json(); // pair counts, chunk timings per thread and load imbalance
+ * ~~~
+ */
+namespace Instrumentation {
+
+/** No-op instrument; the default for all drivers */
+struct disabled {
+    static constexpr bool enabled = false;
+    struct chunk_scope {
+        inline void pairs(std::size_t) const {}
+        inline void skipped(std::size_t) const {}
+    };
+    inline chunk_scope chunk(std::size_t, std::size_t) const { return {}; }
+    inline void workers(std::size_t) const {}
+};
+
+/** Shared default argument of the drivers */
+inline disabled off;
+
+/**
+ * @brief Cache misses of the calling thread since its first call, or -1 if unavailable
+ *
+ * Each thread opens one counter, in user space only, which is what `perf_event_paranoid`
+ * up to 2 permits for unprivileged processes.
+ */
+inline std::int64_t cache_misses() {
+#ifdef INSTRUMENTATION_PERF_EVENT
+    struct counter {
+        int fd = -1;
+        counter() {
+            perf_event_attr attr{};
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.size = sizeof(attr);
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0)); // this thread, any cpu
+        }
+        ~counter() {
+            if (fd >= 0)
+                close(fd);
+        }
+    };
+    thread_local counter c;
+    std::int64_t value = 0;
+    if (c.fd >= 0 and read(c.fd, &value, sizeof(value)) == sizeof(value))
+        return value;
+#endif
+    return -1;
+}
+
+/** Collects pair counts and per thread chunk timings; safe to use from several threads */
+class recorder {
+  public:
+    static constexpr bool enabled = true;
+
+    struct chunk_record {
+        std::size_t first, last;            // index range, of pairs or cells
+        std::size_t pairs = 0, skipped = 0; // pairs visited; candidates rejected by a cutoff
+        std::int64_t nanoseconds = 0;       // wall time
+        std::int64_t cache_misses = -1;     // -1 if unavailable
+    };
+    struct thread_record {
+        std::thread::id id;
+        std::vector<chunk_record> chunks;
+    };
+
+    /** Times a chunk from construction to destruction, adding its record to the calling thread */
+    class chunk_scope {
+        recorder *parent;
+        chunk_record record;
+        std::chrono::steady_clock::time_point start;
+        std::int64_t misses_at_start;
+
+      public:
+        chunk_scope(recorder *parent, std::size_t first, std::size_t last)
+            : parent(parent), record{first, last}, start(std::chrono::steady_clock::now()),
+              misses_at_start(Instrumentation::cache_misses()) {}
+        chunk_scope(const chunk_scope &) = delete;
+        ~chunk_scope() {
+            record.nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     std::chrono::steady_clock::now() - start)
+                                     .count();
+            if (misses_at_start >= 0)
+                record.cache_misses = Instrumentation::cache_misses() - misses_at_start;
+            parent->add(record);
+        }
+        inline void pairs(std::size_t n) { record.pairs += n; }
+        inline void skipped(std::size_t n) { record.skipped += n; }
+    };
+
+    /** Start timing chunk [first, last) */
+    chunk_scope chunk(std::size_t first, std::size_t last) { return chunk_scope(this, first, last); }
+
+    /**
+     * @brief Register the number of threads taking part in a loop, as the drivers do
+     *
+     * Threads that record no chunks are then counted as idle by `imbalance()`. The largest
+     * count since the last `clear()` is kept.
+     */
+    void workers(std::size_t n) {
+        std::lock_guard<std::mutex> lock(mutex);
+        participants = std::max(participants, n);
+    }
+
+    /** Records per thread, in order of first appearance */
+    std::vector<thread_record> threads() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return records;
+    }
+    std::size_t pairs() const { return sum(&chunk_record::pairs); }
+    std::size_t skipped() const { return sum(&chunk_record::skipped); }
+    std::size_t chunks() const { return sum([](const chunk_record &) { return std::size_t(1); }); }
+
+    /** Total cache misses, or -1 if any chunk lacked a counter */
+    std::int64_t cache_misses() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::int64_t total = 0;
+        for (const auto &t : records)
+            for (const auto &c : t.chunks) {
+                if (c.cache_misses < 0)
+                    return -1;
+                total += c.cache_misses;
+            }
+        return total;
+    }
+
+    /**
+     * @brief Busy time of the busiest thread over the mean busy time; 1 is perfect balance
+     *
+     * The mean is taken over the registered `workers()`, idle ones included, or over the threads
+     * that recorded chunks if these are more.
+     */
+    double imbalance() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::int64_t max = 0, total = 0;
+        for (const auto &t : records) {
+            std::int64_t busy = 0;
+            for (const auto &c : t.chunks)
+                busy += c.nanoseconds;
+            max = std::max(max, busy);
+            total += busy;
+        }
+        return total > 0 ? double(max) * std::max(records.size(), participants) / total : 1.0;
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        records.clear();
+        participants = 0;
+    }
+
+    /** Summary and per thread chunk records as a JSON object; unavailable counters are `null` */
+    std::string json() const {
+        auto misses = [](std::int64_t n) { return n < 0 ? std::string("null") : std::to_string(n); };
+        std::ostringstream o;
+        o << "{\"pairs\": " << pairs() << ", \"skipped\": " << skipped() << ", \"chunks\": " << chunks()
+          << ", \"cache_misses\": " << misses(cache_misses()) << ", \"imbalance\": " << imbalance()
+          << ", \"threads\": [";
+        auto all = threads();
+        for (std::size_t t = 0; t < all.size(); t++) {
+            o << (t > 0 ? ", " : "") << "{\"thread\": " << t << ", \"chunks\": [";
+            for (std::size_t k = 0; k < all[t].chunks.size(); k++) {
+                const auto &c = all[t].chunks[k];
+                o << (k > 0 ? ", " : "") << "{\"first\": " << c.first << ", \"last\": " << c.last
+                  << ", \"pairs\": " << c.pairs << ", \"skipped\": " << c.skipped << ", \"ns\": " << c.nanoseconds
+                  << ", \"cache_misses\": " << misses(c.cache_misses) << "}";
+            }
+            o << "]}";
+        }
+        o << "]}";
+        return o.str();
+    }
+
+  private:
+    mutable std::mutex mutex;
+    std::vector<thread_record> records;
+    std::size_t participants = 0; // registered workers
+
+    void add(const chunk_record &record) {
+        const auto id = std::this_thread::get_id();
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = std::find_if(records.begin(), records.end(), [&](const auto &t) { return t.id == id; });
+        if (it == records.end())
+            it = records.insert(records.end(), thread_record{id, {}});
+        it->chunks.push_back(record);
+    }
+    template <class F> std::size_t sum(F f) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::size_t total = 0;
+        for (const auto &t : records)
+            for (const auto &c : t.chunks)
+                total += std::invoke(f, c);
+        return total;
+    }
+};
+
+} // namespace Instrumentation
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE("instrumentation") {
+    using namespace Instrumentation;
+    static_assert(std::is_empty<disabled>::value and std::is_empty<disabled::chunk_scope>::value);
+    recorder stats;
+    std::thread worker([&] {
+        auto chunk = stats.chunk(10, 20);
+        chunk.pairs(10);
+        chunk.skipped(3);
+    });
+    worker.join();
+    for (std::size_t k = 0; k < 2; k++) {
+        auto chunk = stats.chunk(k * 5, k * 5 + 5);
+        chunk.pairs(5);
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    CHECK(stats.pairs() == 20);
+    CHECK(stats.skipped() == 3);
+    CHECK(stats.chunks() == 3);
+    auto threads = stats.threads();
+    CHECK(threads.size() == 2);
+    CHECK(threads[0].chunks.front().first == 10);
+    CHECK(threads[1].chunks.back().nanoseconds >= 2000000);
+    CHECK(stats.imbalance() > 1.5); // nearly all time in the second thread
+    const double busy_imbalance = stats.imbalance();
+    stats.workers(4); // two more threads that got no work
+    CHECK(stats.imbalance() == doctest::Approx(2 * busy_imbalance));
+    stats.workers(1);
+    CHECK(stats.imbalance() == doctest::Approx(2 * busy_imbalance));
+    auto json = stats.json();
+    CHECK(json.find("\"pairs\": 20") != std::string::npos);
+    CHECK(json.find("\"first\": 10, \"last\": 20, \"pairs\": 10, \"skipped\": 3") != std::string::npos);
+    CHECK((stats.cache_misses() >= 0 or json.find("\"cache_misses\": null") != std::string::npos));
+    stats.clear();
+    CHECK(stats.chunks() == 0);
+    CHECK(stats.imbalance() == 1.0);
+    stats.workers(3); // one thread did everything
+    stats.chunk(0, 1).pairs(1);
+    CHECK(stats.imbalance() == doctest::Approx(3.0));
+}
+#endif
@@ -1,29 +1,581 @@
 #pragma once
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
 #include <type_traits>
 
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define INVSQRT_DISPATCH // compile kernels for all x86 instruction sets and select at runtime
+#define INVSQRT_TARGET(isa) __attribute__((target(isa)))
+#else
+#define INVSQRT_TARGET(isa)
+#endif
+
+#if defined(__SSE2__) || defined(__AVX2__) || defined(__AVX512F__) || defined(INVSQRT_DISPATCH)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#if __cplusplus > 201703L && __has_include(<span>)
+#include <span>
+#endif
+#if __has_include(<Eigen/Core>)
+#include <Eigen/Core>
+#define INVSQRT_EIGEN
+#endif
+
+namespace InvSqrt {
+
+/**
+ * @brief Magic constants and Newton coefficients for each floating point precision
+ *
+ * Newton step `k` refines the estimate as `y = y * (a[k] - b[k] * x * y * y)`. Rather than
+ * the textbook 1.5 and 0.5, `a` and `b` minimize the maximum relative error after each step,
+ * given the error range left by the step before. Likewise, the magic constant is tuned for use
+ * without (`magic[0]`) and with (`magic[1]`) subsequent Newton steps (Moroz et al., 2018).
+ *
+ * `max_relative_error[k]` is the measured maximum relative error after `k` steps for all normal
+ * numbers, with and without fused multiply-add. This was tested exhaustively for float and _Float16
+ * and sampled otherwise. For float, the largest errors of two or more steps occur in the two lowest
+ * binades where `b * x` is subnormal.
+ */
+template <typename T> struct constants;
+
+template <> struct constants<float> {
+    using seed_type = float;
+    using integer = std::int32_t;
+    static constexpr integer magic[2] = {0x5f37642f, 0x5f1ffffc};
+    static constexpr float a[3] = {1.6819143929842419f, 1.5000003697660031f, 1.5000000000000882f};
+    static constexpr float b[3] = {0.70395261905207895f, 0.50000005282371374f, 0.50000000000001266f};
+    static constexpr double max_relative_error[4] = {3.5e-2, 6.6e-4, 5.0e-7, 1.9e-7};
+};
+
+template <> struct constants<double> {
+    using seed_type = double;
+    using integer = std::int64_t;
+    static constexpr integer magic[2] = {0x5fe6ec85e7de30da, 0x5fe3fffe00000000};
+    static constexpr double a[3] = {1.6819158458767201, 1.5000003697615134, 1.5000000000000882};
+    static constexpr double b[3] = {0.70395444889775738, 0.50000005282307225, 0.50000000000001266};
+    static constexpr double max_relative_error[4] = {3.5e-2, 6.6e-4, 3.3e-7, 8.0e-14};
+};
+
+/** Seeded via double, so the argument must be within the range of double */
+template <> struct constants<long double> {
+    using seed_type = double;
+    using integer = std::int64_t;
+    static constexpr integer magic[2] = {constants<double>::magic[0], constants<double>::magic[1]};
+    static constexpr long double a[3] = {1.6819158458767201L, 1.5000003697615134L, 1.5000000000000882L};
+    static constexpr long double b[3] = {0.70395444889775738L, 0.50000005282307225L, 0.50000000000001266L};
+    static constexpr double max_relative_error[4] = {3.5e-2, 6.6e-4, 3.3e-7, 8.0e-14};
+};
+
+#ifdef __FLT16_MAX__
+/** Half precision (GCC and Clang); rounding dominates the error beyond one step */
+template <> struct constants<_Float16> {
+    using seed_type = _Float16;
+    using integer = std::int16_t;
+    static constexpr integer magic[2] = {0x59bb, 0x5901};
+    static constexpr _Float16 a[3] = {_Float16(1.6805482f), _Float16(1.5000004f), _Float16(1.5f)};
+    static constexpr _Float16 b[3] = {_Float16(0.70222850f), _Float16(0.50000005f), _Float16(0.5f)};
+    static constexpr double max_relative_error[4] = {3.5e-2, 1.9e-3, 1.3e-3, 1.1e-3};
+};
+#endif
+
+/** True for the floating point types supported by `inv_sqrt()` */
+template <typename T, typename = void> struct is_supported : std::false_type {};
+template <typename T> struct is_supported<T, std::void_t<decltype(constants<T>::magic)>> : std::true_type {};
+
+} // namespace InvSqrt
+
 /**
  * @brief Fast inverse square-root approximation
  *
- * Modified to work with both double and float and with one (less precise) or
- * two (more precise) iterations. Template conditionals are optimized out at
- * compile time (ML, 2019)
+ * Modified to work with float, double, long double and, where available, _Float16
+ * and with zero to three Newton iterations, trading speed for precision as listed by
+ * `inv_sqrt_max_error`. Template conditionals are optimized out at compile time (ML, 2019)
  *
  * @note Code comments supposedly from the original Quake III Arena code
  */
-template <typename T, char iterations = 2> inline T inv_sqrt(T x) {
+template <typename T, char iterations = 2> inline std::enable_if_t<not std::is_class<T>::value, T> inv_sqrt(T x) {
+    static_assert(InvSqrt::is_supported<T>::value, "T must be floating point");
+    static_assert(iterations >= 0 and iterations <= 3, "iterations must be in the range 0-3");
+    using C = InvSqrt::constants<T>;
+    typename C::seed_type y = x;
+    typename C::integer i;
+    std::memcpy(&i, &y, sizeof(y));          // evil floating point bit level hacking
+    i = C::magic[iterations > 0] - (i >> 1); // what the fuck?
+    std::memcpy(&y, &i, sizeof(y));
+    T z = y;
+    for (int k = 0; k < iterations; k++)
+        z = z * (C::a[k] - C::b[k] * x * z * z); // Newton iterations with tuned coefficients
+    return z;
+}
+
+/** Measured maximum relative error of `inv_sqrt<T, iterations>()` for normal numbers */
+template <typename T, char iterations = 2>
+inline constexpr double inv_sqrt_max_error = InvSqrt::constants<T>::max_relative_error[iterations];
+
+/**
+ * @brief Fewest Newton iterations for which `inv_sqrt<T, iterations>()` meets a relative tolerance
+ *
+ * Returns -1 if no variant is precise enough. Example:
+ *
+ * ~~~ cpp
+ * constexpr auto iterations = inv_sqrt_iterations<float>(1e-3); // 1
+ * float y = inv_sqrt<float, iterations>(x);
+ * ~~~
+ */
+template <typename T> constexpr char inv_sqrt_iterations(double tolerance) {
+    for (int k = 0; k < 4; k++)
+        if (InvSqrt::constants<T>::max_relative_error[k] <= tolerance)
+            return k;
+    return -1;
+}
+
+/**
+ * @brief SIMD kernels for the fast inverse square root
+ *
+ * Each kernel applies the magic constant and Newton steps of the scalar
+ * `inv_sqrt()` lane-wise to as many whole SIMD registers as fit in `n` and
+ * returns the number of elements processed. The caller handles the tail.
+ * The `rsqrt_*` kernels instead refine the hardware estimate instruction.
+ *
+ * With GCC and Clang on x86, all x86 kernels are compiled regardless of the
+ * `-m` flags using target attributes, and the widest kernel supported by the
+ * running CPU is selected at the first call (see `active_isa()`).
+ */
+namespace InvSqrt {
+
+#if defined(__SSE2__) || defined(INVSQRT_DISPATCH)
+template <char iterations> INVSQRT_TARGET("sse2") std::size_t sse2(const float *in, float *out, std::size_t n) {
+    using C = constants<float>;
+    const __m128i magic = _mm_set1_epi32(C::magic[iterations > 0]);
+    std::size_t k = 0;
+    for (; k + 4 <= n; k += 4) {
+        __m128 x = _mm_loadu_ps(in + k);
+        __m128 y = _mm_castsi128_ps(_mm_sub_epi32(magic, _mm_srli_epi32(_mm_castps_si128(x), 1)));
+        for (int i = 0; i < iterations; i++) {
+            __m128 bxyy = _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(_mm_set1_ps(C::b[i]), x), y), y); // b x y^2
+            y = _mm_mul_ps(y, _mm_sub_ps(_mm_set1_ps(C::a[i]), bxyy));
+        }
+        _mm_storeu_ps(out + k, y);
+    }
+    return k;
+}
+
+template <char iterations> INVSQRT_TARGET("sse2") std::size_t sse2(const double *in, double *out, std::size_t n) {
+    using C = constants<double>;
+    const __m128i magic = _mm_set1_epi64x(C::magic[iterations > 0]);
+    std::size_t k = 0;
+    for (; k + 2 <= n; k += 2) {
+        __m128d x = _mm_loadu_pd(in + k);
+        __m128d y = _mm_castsi128_pd(_mm_sub_epi64(magic, _mm_srli_epi64(_mm_castpd_si128(x), 1)));
+        for (int i = 0; i < iterations; i++) {
+            __m128d bxyy = _mm_mul_pd(_mm_mul_pd(_mm_mul_pd(_mm_set1_pd(C::b[i]), x), y), y); // b x y^2
+            y = _mm_mul_pd(y, _mm_sub_pd(_mm_set1_pd(C::a[i]), bxyy));
+        }
+        _mm_storeu_pd(out + k, y);
+    }
+    return k;
+}
+
+template <char iterations> INVSQRT_TARGET("sse2") std::size_t rsqrt_sse2(const float *in, float *out, std::size_t n) {
+    const __m128 half = _mm_set1_ps(0.5f), threehalfs = _mm_set1_ps(1.5f);
+    std::size_t k = 0;
+    for (; k + 4 <= n; k += 4) {
+        __m128 x = _mm_loadu_ps(in + k);
+        __m128 x2 = _mm_mul_ps(x, half);
+        __m128 y = _mm_rsqrt_ps(x); // 12 bit estimate
+        for (char i = 0; i < iterations; i++)
+            y = _mm_mul_ps(y, _mm_sub_ps(threehalfs, _mm_mul_ps(x2, _mm_mul_ps(y, y))));
+        _mm_storeu_ps(out + k, y);
+    }
+    return k;
+}
+#endif
+
+#if defined(__AVX2__) || defined(INVSQRT_DISPATCH)
+template <char iterations> INVSQRT_TARGET("avx2") std::size_t avx2(const float *in, float *out, std::size_t n) {
+    using C = constants<float>;
+    const __m256i magic = _mm256_set1_epi32(C::magic[iterations > 0]);
+    std::size_t k = 0;
+    for (; k + 8 <= n; k += 8) {
+        __m256 x = _mm256_loadu_ps(in + k);
+        __m256 y = _mm256_castsi256_ps(_mm256_sub_epi32(magic, _mm256_srli_epi32(_mm256_castps_si256(x), 1)));
+        for (int i = 0; i < iterations; i++) {
+            __m256 bxyy = _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(C::b[i]), x), y), y); // b x y^2
+            y = _mm256_mul_ps(y, _mm256_sub_ps(_mm256_set1_ps(C::a[i]), bxyy));
+        }
+        _mm256_storeu_ps(out + k, y);
+    }
+    return k;
+}
+
+template <char iterations> INVSQRT_TARGET("avx2") std::size_t avx2(const double *in, double *out, std::size_t n) {
+    using C = constants<double>;
+    const __m256i magic = _mm256_set1_epi64x(C::magic[iterations > 0]);
+    std::size_t k = 0;
+    for (; k + 4 <= n; k += 4) {
+        __m256d x = _mm256_loadu_pd(in + k);
+        __m256d y = _mm256_castsi256_pd(_mm256_sub_epi64(magic, _mm256_srli_epi64(_mm256_castpd_si256(x), 1)));
+        for (int i = 0; i < iterations; i++) {
+            __m256d bxyy = _mm256_mul_pd(_mm256_mul_pd(_mm256_mul_pd(_mm256_set1_pd(C::b[i]), x), y), y); // b x y^2
+            y = _mm256_mul_pd(y, _mm256_sub_pd(_mm256_set1_pd(C::a[i]), bxyy));
+        }
+        _mm256_storeu_pd(out + k, y);
+    }
+    return k;
+}
+
+template <char iterations> INVSQRT_TARGET("avx2") std::size_t rsqrt_avx2(const float *in, float *out, std::size_t n) {
+    const __m256 half = _mm256_set1_ps(0.5f), threehalfs = _mm256_set1_ps(1.5f);
+    std::size_t k = 0;
+    for (; k + 8 <= n; k += 8) {
+        __m256 x = _mm256_loadu_ps(in + k);
+        __m256 x2 = _mm256_mul_ps(x, half);
+        __m256 y = _mm256_rsqrt_ps(x); // 12 bit estimate
+        for (char i = 0; i < iterations; i++)
+            y = _mm256_mul_ps(y, _mm256_sub_ps(threehalfs, _mm256_mul_ps(x2, _mm256_mul_ps(y, y))));
+        _mm256_storeu_ps(out + k, y);
+    }
+    return k;
+}
+#endif
+
+#if defined(__AVX512F__) || defined(INVSQRT_DISPATCH)
+template <char iterations> INVSQRT_TARGET("avx512f") std::size_t avx512(const float *in, float *out, std::size_t n) {
+    using C = constants<float>;
+    const __m512i magic = _mm512_set1_epi32(C::magic[iterations > 0]);
+    const __mmask16 all = 0xffff; // zero-masked forms avoid GCC's undefined pass-through operands
+    std::size_t k = 0;
+    for (; k + 16 <= n; k += 16) {
+        __m512 x = _mm512_loadu_ps(in + k);
+        __m512i half_bits = _mm512_maskz_srli_epi32(all, _mm512_castps_si512(x), 1);
+        __m512 y = _mm512_castsi512_ps(_mm512_sub_epi32(magic, half_bits));
+        for (int i = 0; i < iterations; i++) {
+            __m512 bxyy = _mm512_mul_ps(_mm512_mul_ps(_mm512_mul_ps(_mm512_set1_ps(C::b[i]), x), y), y); // b x y^2
+            y = _mm512_mul_ps(y, _mm512_sub_ps(_mm512_set1_ps(C::a[i]), bxyy));
+        }
+        _mm512_storeu_ps(out + k, y);
+    }
+    return k;
+}
+
+template <char iterations> INVSQRT_TARGET("avx512f") std::size_t avx512(const double *in, double *out, std::size_t n) {
+    using C = constants<double>;
+    const __m512i magic = _mm512_set1_epi64(C::magic[iterations > 0]);
+    const __mmask8 all = 0xff;
+    std::size_t k = 0;
+    for (; k + 8 <= n; k += 8) {
+        __m512d x = _mm512_loadu_pd(in + k);
+        __m512i half_bits = _mm512_maskz_srli_epi64(all, _mm512_castpd_si512(x), 1);
+        __m512d y = _mm512_castsi512_pd(_mm512_sub_epi64(magic, half_bits));
+        for (int i = 0; i < iterations; i++) {
+            __m512d bxyy = _mm512_mul_pd(_mm512_mul_pd(_mm512_mul_pd(_mm512_set1_pd(C::b[i]), x), y), y); // b x y^2
+            y = _mm512_mul_pd(y, _mm512_sub_pd(_mm512_set1_pd(C::a[i]), bxyy));
+        }
+        _mm512_storeu_pd(out + k, y);
+    }
+    return k;
+}
+
+template <char iterations>
+INVSQRT_TARGET("avx512f") std::size_t rsqrt_avx512(const float *in, float *out, std::size_t n) {
+    const __m512 half = _mm512_set1_ps(0.5f), threehalfs = _mm512_set1_ps(1.5f);
+    const __mmask16 all = 0xffff;
+    std::size_t k = 0;
+    for (; k + 16 <= n; k += 16) {
+        __m512 x = _mm512_loadu_ps(in + k);
+        __m512 x2 = _mm512_mul_ps(x, half);
+        __m512 y = _mm512_maskz_rsqrt14_ps(all, x); // 14 bit estimate
+        for (char i = 0; i < iterations; i++)
+            y = _mm512_mul_ps(y, _mm512_sub_ps(threehalfs, _mm512_mul_ps(x2, _mm512_mul_ps(y, y))));
+        _mm512_storeu_ps(out + k, y);
+    }
+    return k;
+}
+
+template <char iterations>
+INVSQRT_TARGET("avx512f") std::size_t rsqrt_avx512(const double *in, double *out, std::size_t n) {
+    const __m512d half = _mm512_set1_pd(0.5), threehalfs = _mm512_set1_pd(1.5);
+    const __mmask8 all = 0xff;
+    std::size_t k = 0;
+    for (; k + 8 <= n; k += 8) {
+        __m512d x = _mm512_loadu_pd(in + k);
+        __m512d x2 = _mm512_mul_pd(x, half);
+        __m512d y = _mm512_maskz_rsqrt14_pd(all, x); // 14 bit estimate
+        for (char i = 0; i < iterations; i++)
+            y = _mm512_mul_pd(y, _mm512_sub_pd(threehalfs, _mm512_mul_pd(x2, _mm512_mul_pd(y, y))));
+        _mm512_storeu_pd(out + k, y);
+    }
+    return k;
+}
+#endif
+
+#ifdef __ARM_NEON
+template <char iterations> std::size_t neon(const float *in, float *out, std::size_t n) {
+    using C = constants<float>;
+    const uint32x4_t magic = vdupq_n_u32(std::uint32_t(C::magic[iterations > 0]));
+    std::size_t k = 0;
+    for (; k + 4 <= n; k += 4) {
+        float32x4_t x = vld1q_f32(in + k);
+        float32x4_t y = vreinterpretq_f32_u32(vsubq_u32(magic, vshrq_n_u32(vreinterpretq_u32_f32(x), 1)));
+        for (int i = 0; i < iterations; i++) {
+            float32x4_t bxyy = vmulq_f32(vmulq_f32(vmulq_f32(vdupq_n_f32(C::b[i]), x), y), y); // b x y^2
+            y = vmulq_f32(y, vsubq_f32(vdupq_n_f32(C::a[i]), bxyy));
+        }
+        vst1q_f32(out + k, y);
+    }
+    return k;
+}
+
+template <char iterations> std::size_t rsqrt_neon(const float *in, float *out, std::size_t n) {
+    std::size_t k = 0;
+    for (; k + 4 <= n; k += 4) {
+        float32x4_t x = vld1q_f32(in + k);
+        float32x4_t y = vrsqrteq_f32(x); // 8 bit estimate
+        for (char i = 0; i < iterations; i++)
+            y = vmulq_f32(y, vrsqrtsq_f32(vmulq_f32(x, y), y)); // y * (3 - x * y * y) / 2
+        vst1q_f32(out + k, y);
+    }
+    return k;
+}
+
+#ifdef __aarch64__
+template <char iterations> std::size_t neon(const double *in, double *out, std::size_t n) {
+    using C = constants<double>;
+    const uint64x2_t magic = vdupq_n_u64(std::uint64_t(C::magic[iterations > 0]));
+    std::size_t k = 0;
+    for (; k + 2 <= n; k += 2) {
+        float64x2_t x = vld1q_f64(in + k);
+        float64x2_t y = vreinterpretq_f64_u64(vsubq_u64(magic, vshrq_n_u64(vreinterpretq_u64_f64(x), 1)));
+        for (int i = 0; i < iterations; i++) {
+            float64x2_t bxyy = vmulq_f64(vmulq_f64(vmulq_f64(vdupq_n_f64(C::b[i]), x), y), y); // b x y^2
+            y = vmulq_f64(y, vsubq_f64(vdupq_n_f64(C::a[i]), bxyy));
+        }
+        vst1q_f64(out + k, y);
+    }
+    return k;
+}
+#endif
+#endif
+
+#if defined(__ARM_NEON) && !defined(__aarch64__)
+template <char iterations> std::size_t neon(const double *, double *, std::size_t) { return 0; } // no double SIMD
+#endif
+
+/** Kernel that processes no elements, leaving everything to the scalar tail */
+template <typename T> std::size_t scalar(const T *, T *, std::size_t) { return 0; }
+
+enum class isa { scalar, sse2, avx2, avx512, neon };
+
+inline const char *name(isa i) {
+    switch (i) {
+    case isa::sse2:
+        return "sse2";
+    case isa::avx2:
+        return "avx2";
+    case isa::avx512:
+        return "avx512";
+    case isa::neon:
+        return "neon";
+    default:
+        return "scalar";
+    }
+}
+
+/** True if the kernels for the given instruction set are compiled in and supported by the running CPU */
+inline bool supported(isa i) {
+#ifdef INVSQRT_DISPATCH
+    __builtin_cpu_init();
+    switch (i) {
+    case isa::scalar:
+        return true;
+    case isa::sse2:
+        return __builtin_cpu_supports("sse2");
+    case isa::avx2:
+        return __builtin_cpu_supports("avx2");
+    case isa::avx512:
+        return __builtin_cpu_supports("avx512f");
+    default:
+        return false;
+    }
+#else
+    switch (i) {
+    case isa::scalar:
+        return true;
+#ifdef __SSE2__
+    case isa::sse2:
+        return true;
+#endif
+#ifdef __AVX2__
+    case isa::avx2:
+        return true;
+#endif
+#ifdef __AVX512F__
+    case isa::avx512:
+        return true;
+#endif
+#ifdef __ARM_NEON
+    case isa::neon:
+        return true;
+#endif
+    default:
+        return false;
+    }
+#endif
+}
+
+/**
+ * @brief Instruction set used by the batch functions
+ *
+ * The widest supported instruction set is detected once, at the first call.
+ * Setting the environment variable `INVSQRT_ISA` to `scalar`, `sse2`, `avx2`,
+ * `avx512` or `neon` forces a given path, e.g. for benchmarking; unsupported
+ * values are ignored.
+ */
+inline isa active_isa() {
+    static const isa selected = [] {
+        if (const char *env = std::getenv("INVSQRT_ISA"))
+            for (auto i : {isa::scalar, isa::sse2, isa::avx2, isa::avx512, isa::neon})
+                if (std::strcmp(env, name(i)) == 0 and supported(i))
+                    return i;
+        for (auto i : {isa::avx512, isa::avx2, isa::sse2, isa::neon})
+            if (supported(i))
+                return i;
+        return isa::scalar;
+    }();
+    return selected;
+}
+
+template <typename T> using kernel = std::size_t (*)(const T *, T *, std::size_t);
+
+/** Magic constant kernel for a given instruction set */
+template <char iterations, typename T> kernel<T> magic_kernel(isa i) {
+    switch (i) {
+#if defined(__SSE2__) || defined(INVSQRT_DISPATCH)
+    case isa::sse2:
+        return sse2<iterations>;
+#endif
+#if defined(__AVX2__) || defined(INVSQRT_DISPATCH)
+    case isa::avx2:
+        return avx2<iterations>;
+#endif
+#if defined(__AVX512F__) || defined(INVSQRT_DISPATCH)
+    case isa::avx512:
+        return avx512<iterations>;
+#endif
+#ifdef __ARM_NEON
+    case isa::neon:
+        return neon<iterations>;
+#endif
+    default:
+        return scalar<T>;
+    }
+}
+
+/** Hardware estimate kernel for a given instruction set; only AVX-512 has a double precision estimate */
+template <char iterations, typename T> kernel<T> rsqrt_kernel(isa i) {
+    constexpr bool single = std::is_same<T, float>::value;
+    switch (i) {
+#if defined(__SSE2__) || defined(INVSQRT_DISPATCH)
+    case isa::sse2:
+        if constexpr (single)
+            return rsqrt_sse2<iterations>;
+        break;
+#endif
+#if defined(__AVX2__) || defined(INVSQRT_DISPATCH)
+    case isa::avx2:
+        if constexpr (single)
+            return rsqrt_avx2<iterations>;
+        break;
+#endif
+#if defined(__AVX512F__) || defined(INVSQRT_DISPATCH)
+    case isa::avx512:
+        return rsqrt_avx512<iterations>;
+#endif
+#ifdef __ARM_NEON
+    case isa::neon:
+        if constexpr (single)
+            return rsqrt_neon<iterations>;
+        break;
+#endif
+    default:
+        break;
+    }
+    return scalar<T>;
+}
+
+/** Process the SIMD part of an array with the selected magic constant kernel; returns number of processed elements */
+template <char iterations, typename T> std::size_t simd(const T *in, T *out, std::size_t n) {
+    static const kernel<T> f = magic_kernel<iterations, T>(active_isa()); // cached after first call
+    return f(in, out, n);
+}
+
+/** Process the SIMD part of an array with the selected hardware estimate kernel */
+template <char iterations, typename T> std::size_t rsqrt_simd(const T *in, T *out, std::size_t n) {
+    static const kernel<T> f = rsqrt_kernel<iterations, T>(active_isa());
+    return f(in, out, n);
+}
+
+} // namespace InvSqrt
+
+/**
+ * @brief Fast inverse square root of the range [first, last) written to `out`
+ *
+ * Uses the widest SIMD instruction set supported by the CPU (AVX-512, AVX2, SSE2 or NEON)
+ * with the same magic constant and Newton iterations as the scalar version, done lane-wise.
+ * Types other than float and double are handled by the scalar version. The input and output ranges may be identical.
+ */
+template <typename T, char iterations = 2> void inv_sqrt(const T *first, const T *last, T *out) {
+    const auto n = static_cast<std::size_t>(last - first);
+    std::size_t k = 0;
+    if constexpr (std::is_same<T, float>::value or std::is_same<T, double>::value)
+        k = InvSqrt::simd<iterations>(first, out, n);
+    for (; k < n; k++)
+        out[k] = inv_sqrt<T, iterations>(first[k]);
+}
+
+/**
+ * @brief Inverse square root of [first, last) using the hardware estimate instruction and Newton steps
+ *
+ * Refines `rsqrtps` (SSE/AVX), `vrsqrt14` (AVX-512) or `vrsqrte` (NEON) lane-wise;
+ * where no such instruction exists for `T`, this falls back to `1 / std::sqrt`.
+ */
+template <typename T, char iterations = 1> void rsqrt(const T *first, const T *last, T *out) {
     static_assert(std::is_floating_point<T>::value, "T must be floating point");
-    static_assert(iterations == 1 or iterations == 2, "itarations must equal 1 or 2");
-    typedef typename std::conditional<sizeof(T) == 8, std::int64_t, std::int32_t>::type Tint;
-    T y = x;
-    T x2 = y * 0.5;
-    Tint i = *(Tint *)&y;                                              // evil floating point bit level hacking
-    i = (sizeof(T) == 8 ? 0x5fe6eb50c7b537a9 : 0x5f3759df) - (i >> 1); // what the fuck?
-    y = *(T *)&i;
-    y = y * (1.5 - (x2 * y * y)); // 1st iteration
-    if (iterations > 1)
-        y = y * (1.5 - (x2 * y * y)); // 2nd iteration, this can be removed
+    const auto n = static_cast<std::size_t>(last - first);
+    for (auto k = InvSqrt::rsqrt_simd<iterations>(first, out, n); k < n; k++)
+        out[k] = T(1) / std::sqrt(first[k]);
+}
+
+#if __cplusplus > 201703L && __has_include(<span>)
+/** @brief Fast inverse square root of a span; `out` must be at least as large as `in` */
+template <typename T, char iterations = 2> void inv_sqrt(std::span<const T> in, std::span<T> out) {
+    inv_sqrt<T, iterations>(in.data(), in.data() + in.size(), out.data());
+}
+#endif
+
+#ifdef INVSQRT_EIGEN
+/**
+ * @brief Fast inverse square root of an Eigen array expression
+ *
+ * The expression, e.g. a strided `asEigenVector()` view, is evaluated into contiguous
+ * storage of scalar `T`, by default that of the expression, which is then processed by the
+ * SIMD kernels. Available whenever Eigen is found, regardless of the include order.
+ */
+template <typename T = void, char iterations = 2, typename Derived> auto inv_sqrt(const Eigen::ArrayBase<Derived> &x) {
+    using scalar = std::conditional_t<std::is_void<T>::value, typename Derived::Scalar, T>;
+    auto y = x.template cast<scalar>().eval();
+    inv_sqrt<scalar, iterations>(y.data(), y.data() + y.size(), y.data());
     return y;
 }
+#endif
 
 #ifdef DOCTEST_LIBRARY_INCLUDED
 TEST_CASE_TEMPLATE("inv_sqrt", T, double, float) {
@@ -31,5 +583,107 @@ TEST_CASE_TEMPLATE("inv_sqrt", T, double, float) {
     for (auto x : vals)
         CHECK(inv_sqrt<T>(x) == doctest::Approx(1.0 / std::sqrt(x)));
 }
+
+TEST_CASE_TEMPLATE("inv_sqrt_max_error", T, double, float, long double) {
+    auto check = [](auto iterations) {
+        constexpr char k = decltype(iterations)::value;
+        double max_error = 0;
+        for (int exponent = -60; exponent <= 60; exponent += 7)
+            for (int i = 0; i < 1000; i++) {
+                const T x = std::ldexp(T(1) + T(3) * i / 1000, exponent);
+                const long double exact = 1.0L / std::sqrt(static_cast<long double>(x));
+                max_error = std::max(max_error, double(std::fabs((inv_sqrt<T, k>(x) - exact) / exact)));
+            }
+        CHECK(max_error <= inv_sqrt_max_error<T, k>);
+    };
+    check(std::integral_constant<char, 0>());
+    check(std::integral_constant<char, 1>());
+    check(std::integral_constant<char, 2>());
+    check(std::integral_constant<char, 3>());
+
+    static_assert(inv_sqrt_iterations<T>(0.1) == 0);
+    static_assert(inv_sqrt_iterations<T>(1e-3) == 1);
+    static_assert(inv_sqrt_iterations<T>(1e-6) == 2);
+    static_assert(inv_sqrt_iterations<T>(1e-20) == -1);
+}
+
+/** Largest relative errors of `inv_sqrt<T, 0-3>()` over the normal numbers with bit patterns [first, last) */
+template <typename T, typename Bits> std::array<double, 4> inv_sqrt_sweep(Bits first, Bits last) {
+    static_assert(sizeof(T) <= sizeof(float));
+    std::array<double, 4> max_error = {0, 0, 0, 0};
+    for (Bits bits = first; bits != last; bits++) {
+        T x;
+        std::memcpy(&x, &bits, sizeof(x));
+        const double exact = 1.0 / std::sqrt(static_cast<double>(x)); // plenty for float and _Float16
+        const T y[4] = {inv_sqrt<T, 0>(x), inv_sqrt<T, 1>(x), inv_sqrt<T, 2>(x), inv_sqrt<T, 3>(x)};
+        for (int k = 0; k < 4; k++)
+            max_error[k] = std::max(max_error[k], double(std::fabs((y[k] - exact) / exact)));
+    }
+    return max_error;
+}
+
+TEST_CASE("inv_sqrt_max_error_exhaustive") {
+    // float: the two lowest binades, where `b * x` is subnormal, and two more binades standing in
+    // for all others, as the error repeats with a period of two binades
+    const auto single = inv_sqrt_sweep<float, std::uint32_t>(1u << 23, 5u << 23);
+    for (int k = 0; k < 4; k++)
+        CHECK(single[k] <= InvSqrt::constants<float>::max_relative_error[k]);
+#ifdef __FLT16_MAX__
+    const auto half = inv_sqrt_sweep<_Float16, std::uint16_t>(0x0400, 0x7c00); // all normal numbers
+    for (int k = 0; k < 4; k++)
+        CHECK(half[k] <= InvSqrt::constants<_Float16>::max_relative_error[k]);
+#endif
+    static_assert(inv_sqrt_iterations<float>(1.8e-7) == -1);
+    static_assert(inv_sqrt_iterations<float>(1.9e-7) == 3);
+}
+#endif
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE_TEMPLATE("inv_sqrt_batch", T, double, float) {
+    for (std::size_t n : {0, 1, 3, 7, 16, 31, 100}) { // exercise SIMD body and scalar tail
+        std::vector<T> x(n), y(n), z(n);
+        for (std::size_t i = 0; i < n; i++)
+            x[i] = T(0.1) + T(3.7) * i;
+        inv_sqrt<T>(x.data(), x.data() + n, y.data());
+        rsqrt<T>(x.data(), x.data() + n, z.data());
+        for (std::size_t i = 0; i < n; i++) {
+            CHECK(y[i] == doctest::Approx(inv_sqrt<T>(x[i])));
+            CHECK(z[i] == doctest::Approx(1.0 / std::sqrt(x[i])).epsilon(1e-4));
+        }
+        // all kernels supported by this CPU must agree with the scalar version
+        for (auto isa : {InvSqrt::isa::sse2, InvSqrt::isa::avx2, InvSqrt::isa::avx512, InvSqrt::isa::neon}) {
+            if (not InvSqrt::supported(isa))
+                continue;
+            std::fill(y.begin(), y.end(), T(0));
+            std::fill(z.begin(), z.end(), T(0));
+            auto m = InvSqrt::magic_kernel<2, T>(isa)(x.data(), y.data(), n);
+            auto r = InvSqrt::rsqrt_kernel<1, T>(isa)(x.data(), z.data(), n);
+            CHECK(m <= n);
+            for (std::size_t i = 0; i < m; i++)
+                CHECK(y[i] == doctest::Approx(inv_sqrt<T>(x[i])));
+            for (std::size_t i = 0; i < r; i++)
+                CHECK(z[i] == doctest::Approx(1.0 / std::sqrt(x[i])).epsilon(1e-4));
+        }
+        inv_sqrt<T, 1>(x.data(), x.data() + n, x.data()); // in place
+        for (std::size_t i = 0; i < n; i++)
+            CHECK(x[i] == doctest::Approx(1.0 / std::sqrt(T(0.1) + T(3.7) * i)).epsilon(2e-3));
+    }
+    CHECK(InvSqrt::supported(InvSqrt::active_isa()));
+}
 #endif
 
+#if defined(DOCTEST_LIBRARY_INCLUDED) && defined(INVSQRT_EIGEN)
+TEST_CASE("inv_sqrt_eigen") {
+    Eigen::ArrayXXd m = Eigen::ArrayXXd::Random(5, 3).abs() + 0.1;
+    Eigen::ArrayXXd y = inv_sqrt(m);
+    CHECK(y.rows() == 5);
+    CHECK(y.cols() == 3);
+    CHECK((y * m.sqrt() - 1).abs().maxCoeff() < 1e-5); // relative error
+    Eigen::ArrayXf v = inv_sqrt<float, 1>(m.col(1).cast<float>()); // expression
+    CHECK(v.size() == 5);
+    CHECK(v[2] == doctest::Approx(1.0 / std::sqrt(m(2, 1))).epsilon(2e-3));
+    auto w = inv_sqrt<float, 1>(m.col(1)); // converted to float
+    static_assert(std::is_same<decltype(w)::Scalar, float>::value);
+    CHECK((w - v).abs().maxCoeff() == 0);
+}
+#endif
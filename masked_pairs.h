@@ -0,0 +1,367 @@
+/*
+ *  Copyright (C) 2020-present  Mikael Lund (github.com/mlund/cpptricks)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include "pairwise_iterator.h"
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <numeric>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#if __has_include(<bit>)
+#include <bit>
+#endif
+
+namespace PairwiseIterator {
+
+/** Index of the lowest set bit of a non-zero word */
+inline unsigned lowest_bit(std::uint64_t word) {
+#if defined(__cpp_lib_bitops)
+    return static_cast<unsigned>(std::countr_zero(word));
+#elif defined(__GNUC__)
+    return static_cast<unsigned>(__builtin_ctzll(word)); // tzcnt/bsf
+#else
+    unsigned bit = 0;
+    while ((word & 1) == 0) {
+        word >>= 1;
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+/** Number of set bits in a word */
+inline unsigned bit_count(std::uint64_t word) {
+#if defined(__cpp_lib_bitops)
+    return static_cast<unsigned>(std::popcount(word));
+#elif defined(__GNUC__)
+    return static_cast<unsigned>(__builtin_popcountll(word));
+#else
+    unsigned count = 0;
+    for (; word != 0; word &= word - 1)
+        count++;
+    return count;
+#endif
+}
+
+/**
+ * @brief Bit set marking active elements, scanned a 64 bit word at a time
+ *
+ * `next(i)` finds the first active index from `i` with one bit scan per word so that long runs
+ * of inactive elements cost one instruction per 64 elements. Bits past `size()` are kept zero.
+ */
+class active_mask {
+    std::vector<std::uint64_t> words;
+    std::size_t n = 0;
+
+  public:
+    explicit active_mask(std::size_t n = 0, bool active = true) { resize(n, active); }
+
+    void resize(std::size_t size, bool active = true) {
+        const auto old = n;
+        n = size;
+        words.resize((n + 63) / 64, 0);
+        for (auto i = old; i < n; i++) // new elements
+            set(i, active);
+        if (n % 64 != 0)
+            words.back() &= ~std::uint64_t(0) >> (64 - n % 64);
+    }
+    std::size_t size() const { return n; }
+    inline bool test(std::size_t i) const { return (words[i / 64] >> (i % 64)) & 1; }
+    inline void set(std::size_t i, bool active = true) {
+        const auto bit = std::uint64_t(1) << (i % 64);
+        words[i / 64] = active ? words[i / 64] | bit : words[i / 64] & ~bit;
+    }
+    inline void reset(std::size_t i) { set(i, false); }
+    /** Bits of elements [64w, 64w + 64) */
+    inline std::uint64_t word(std::size_t w) const { return words[w]; }
+
+    /** Number of active elements */
+    std::size_t count() const {
+        std::size_t total = 0;
+        for (auto word : words)
+            total += bit_count(word);
+        return total;
+    }
+
+    /** First active index not smaller than `i`, or `size()` if there is none */
+    inline std::size_t next(std::size_t i) const {
+        if (i >= n)
+            return n;
+        auto w = i / 64;
+        auto bits = words[w] & (~std::uint64_t(0) << (i % 64));
+        while (bits == 0) {
+            if (++w == words.size())
+                return n;
+            bits = words[w];
+        }
+        return w * 64 + lowest_bit(bits);
+    }
+};
+
+/**
+ * @brief Unique pairs of active elements, except for a list of excluded pairs
+ *
+ * Iterates as `internal_pairs`, yielding tuples of (const) references, but visits only pairs where
+ * both elements are set in an `active_mask` and which are not excluded, e.g. bonded 1-2 and 1-3
+ * pairs. Inactive elements are skipped with bit scans rather than tested per pair, and exclusions
+ * are stored per row in sorted order so that they are passed with a single moving index.
+ * The mask can be changed through `active()` between loops, e.g. on insertion or deletion in a
+ * grand canonical simulation. Rows act as cells for `parallel_for_pairs(pool, ...)`.
+ *
+ * Example:
+ *
+ * ~~~ cpp
+ * active_mask active(v.size());
+ * active.reset(17); // ghost particle
+ * masked_pairs pairs(v, active, bonds); // bonds as a range of index pairs
+ * for (auto [a, b] : pairs)
+ *     ...
+ * ~~~
+ */
+template <class T, bool Const = std::is_const<T>::value> class masked_pairs {
+    using iter = typename std::conditional<Const, typename T::const_iterator, typename T::iterator>::type;
+    using element = typename std::conditional<Const, typename T::const_reference, typename T::reference>::type;
+    static_assert(std::is_base_of<std::random_access_iterator_tag,
+                                  typename std::iterator_traits<iter>::iterator_category>::value,
+                  "masked_pairs requires a random access container");
+
+    T &vec;
+    active_mask mask;
+    std::vector<std::size_t> exclusion_start, excluded; // partners j > i of row i: [start[i], start[i+1])
+
+  public:
+    class iterator {
+        const masked_pairs *view = nullptr;
+        iter first;
+        std::size_t i = 0, j = 0, e = 0; // current pair; next exclusion in row i to compare with
+        std::uint64_t bits = 0;          // active elements after j in the mask word holding j
+
+        /** Move to the first allowed pair from (i, j), or to the end */
+        void settle() {
+            const auto n = view->mask.size();
+            while (i < n) {
+                for (j = view->mask.next(j); j < n; j = view->mask.next(j + 1)) {
+                    const auto e_end = view->exclusion_start[i + 1];
+                    while (e < e_end and view->excluded[e] < j)
+                        e++;
+                    if (e == e_end or view->excluded[e] != j) {
+                        bits = view->mask.word(j / 64) & (~std::uint64_t(1) << (j % 64));
+                        return;
+                    }
+                }
+                start_row(view->mask.next(i + 1));
+            }
+            i = j = n;
+        }
+        /** Next active j after the current one, from the cached word if possible */
+        inline std::size_t next_j() const {
+            return bits != 0 ? (j & ~std::size_t(63)) + lowest_bit(bits) : view->mask.next((j | 63) + 1);
+        }
+        void start_row(std::size_t row) {
+            i = row;
+            j = i + 1;
+            e = i < view->mask.size() ? view->exclusion_start[i] : 0;
+        }
+
+      public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::tuple<element, element>;
+        using reference = value_type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+
+        iterator() = default;
+        /** First allowed pair whose first element is `row` or later */
+        iterator(const masked_pairs *view, iter first, std::size_t row) : view(view), first(first) {
+            start_row(view->mask.next(row));
+            settle();
+        }
+        inline value_type operator*() const { return {first[i], first[j]}; }
+        /** Container indices of the current pair */
+        inline std::pair<std::size_t, std::size_t> indices() const { return {i, j}; }
+        inline iterator &operator++() {
+            if (bits != 0 and e == view->exclusion_start[i + 1]) { // fast path: next active j in the same word
+                j = (j & ~std::size_t(63)) + lowest_bit(bits);
+                bits &= bits - 1;
+            } else {
+                j = next_j();
+                settle();
+            }
+            return *this;
+        }
+        inline iterator operator++(int) {
+            auto copy = *this;
+            ++*this;
+            return copy;
+        }
+        inline bool operator==(const iterator &other) const { return i == other.i and j == other.j; }
+        inline bool operator!=(const iterator &other) const { return not(*this == other); }
+    };
+
+    /**
+     * @brief View to the pairs of `vec` allowed by `active` and not in `exclusions`
+     *
+     * `exclusions` is a range of index pairs in any order or orientation, e.g. a vector of `std::pair`.
+     */
+    template <class Exclusions = std::vector<std::pair<std::size_t, std::size_t>>>
+    masked_pairs(T &vec, const active_mask &active, const Exclusions &exclusions = {}) : vec(vec), mask(active) {
+        assert(mask.size() == vec.size() && "one mask bit per element");
+        exclusion_start.assign(vec.size() + 1, 0);
+        for (const auto &[a, b] : exclusions)
+            if (a != b)
+                exclusion_start[std::min<std::size_t>(a, b) + 1]++;
+        std::partial_sum(exclusion_start.begin(), exclusion_start.end(), exclusion_start.begin());
+        excluded.resize(exclusion_start.back());
+        auto fill = exclusion_start;
+        for (const auto &[a, b] : exclusions)
+            if (a != b)
+                excluded[fill[std::min<std::size_t>(a, b)]++] = std::max<std::size_t>(a, b);
+        for (std::size_t i = 0; i < vec.size(); i++)
+            std::sort(excluded.begin() + exclusion_start[i], excluded.begin() + exclusion_start[i + 1]);
+    }
+
+    /** Activity of the elements; may be changed between loops but not resized */
+    active_mask &active() { return mask; }
+    const active_mask &active() const { return mask; }
+
+    iterator begin() const { return iterator(this, vec.begin(), 0); }
+    iterator end() const { return iterator(this, vec.begin(), vec.size()); }
+
+    /** Number of allowed pairs, counted from the mask and the exclusions in O(N/64 + active + exclusions) */
+    std::size_t size() const {
+        const auto active = mask.count();
+        std::size_t size = active * (active - (active > 0)) / 2;
+        for (auto i = mask.next(0); i < vec.size(); i = mask.next(i + 1))
+            for (auto e = exclusion_start[i]; e < exclusion_start[i + 1]; e++)
+                size -= mask.test(excluded[e]) and (e == exclusion_start[i] or excluded[e] != excluded[e - 1]);
+        return size;
+    }
+
+    /** Number of rows; see `cell_pairs()` */
+    std::size_t cell_count() const { return vec.size(); }
+
+    /** Range of the pairs whose first element is `row` */
+    struct cell_range {
+        iterator first, last;
+        iterator begin() const { return first; }
+        iterator end() const { return last; }
+    };
+    cell_range cell_pairs(std::size_t row) const {
+        return {iterator(this, vec.begin(), row), iterator(this, vec.begin(), row + 1)};
+    }
+};
+
+template <class T, class Exclusions>
+masked_pairs(T &, const active_mask &, const Exclusions &) -> masked_pairs<T, std::is_const<T>::value>;
+template <class T> masked_pairs(T &, const active_mask &) -> masked_pairs<T, std::is_const<T>::value>;
+
+} // namespace PairwiseIterator
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+#include <atomic>
+#include <random>
+#include <set>
+
+TEST_CASE("active_mask") {
+    using namespace PairwiseIterator;
+    active_mask mask(200, false);
+    CHECK(mask.count() == 0);
+    CHECK(mask.next(0) == 200);
+    mask.set(3);
+    mask.set(64);
+    mask.set(199);
+    CHECK(mask.count() == 3);
+    CHECK(mask.next(0) == 3);
+    CHECK(mask.next(4) == 64);
+    CHECK(mask.next(65) == 199);
+    CHECK(mask.next(200) == 200);
+    mask.reset(64);
+    CHECK(not mask.test(64));
+    CHECK(mask.next(4) == 199);
+    mask.resize(70, true);
+    CHECK(mask.count() == 1);
+    mask.resize(130, true); // new elements are active
+    CHECK(mask.count() == 61);
+    CHECK(mask.next(4) == 70);
+}
+
+TEST_CASE("masked_pairs") {
+    using namespace PairwiseIterator;
+    std::vector<int> v(300);
+    std::iota(v.begin(), v.end(), 0);
+    std::mt19937 engine;
+    std::bernoulli_distribution coin(0.5);
+    active_mask active(v.size());
+    for (std::size_t i = 0; i < v.size(); i++)
+        active.set(i, coin(engine) or (i > 100 and i < 110)); // includes runs of both
+    for (std::size_t i = 150; i < 280; i++)
+        active.reset(i); // long inactive run across words
+    std::vector<std::pair<int, int>> exclusions;
+    for (int i = 0; i + 2 < 300; i++) { // 1-2 and 1-3 pairs along a chain, some reversed
+        exclusions.emplace_back(i, i + 1);
+        exclusions.emplace_back(i % 2 ? i + 2 : i, i % 2 ? i : i + 2);
+    }
+    exclusions.emplace_back(5, 6); // duplicate
+
+    std::set<std::pair<int, int>> excluded;
+    for (auto [a, b] : exclusions)
+        excluded.emplace(std::min(a, b), std::max(a, b));
+    std::vector<std::pair<int, int>> expected;
+    for (auto [a, b] : internal_pairs(v))
+        if (active.test(a) and active.test(b) and excluded.count({a, b}) == 0)
+            expected.emplace_back(a, b);
+
+    masked_pairs pairs(v, active, exclusions);
+    CHECK(pairs.size() == expected.size());
+    std::vector<std::pair<int, int>> found;
+    for (auto [a, b] : pairs)
+        found.emplace_back(a, b);
+    CHECK(found == expected);
+    CHECK(pairs.begin().indices() == std::pair<std::size_t, std::size_t>(expected[0].first, expected[0].second));
+
+    SUBCASE("rows and parallel loop") {
+        std::size_t in_rows = 0;
+        for (std::size_t row = 0; row < pairs.cell_count(); row++)
+            in_rows += std::distance(pairs.cell_pairs(row).begin(), pairs.cell_pairs(row).end());
+        CHECK(in_rows == expected.size());
+        WorkStealing::pool pool(2);
+        std::atomic<std::size_t> cnt = 0;
+        parallel_for_pairs(pool, pairs, [&](auto) { cnt++; });
+        CHECK(cnt == expected.size());
+    }
+    SUBCASE("mask changes and references") {
+        for (std::size_t i = 0; i < v.size(); i++)
+            pairs.active().set(i, i < 4);
+        std::get<0>(*pairs.begin()) = -1; // (0, 3) since 0-1 and 0-2 are excluded
+        CHECK(v[0] == -1);
+        CHECK(pairs.size() == 1);
+        CHECK(std::distance(pairs.begin(), pairs.end()) == 1);
+        pairs.active().set(0, false);
+        CHECK(pairs.size() == 0);
+        CHECK(pairs.begin() == pairs.end());
+    }
+    const auto &cv = v;
+    masked_pairs all(cv, active_mask(v.size()));
+    CHECK(all.size() == v.size() * (v.size() - 1) / 2);
+    CHECK(std::is_same<decltype(std::get<0>(*all.begin())), const int &>::value);
+}
+#endif
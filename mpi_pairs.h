@@ -0,0 +1,261 @@
+/*
+ *  Copyright (C) 2020-present  Mikael Lund (github.com/mlund/cpptricks)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include "pairwise_iterator.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <execution>
+#include <iterator>
+#include <memory_resource>
+#include <numeric>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#if __has_include(<mpi.h>)
+#include <mpi.h>
+#define PAIRS_WITH_MPI
+#endif
+
+/**
+ * @brief Pair loops distributed over MPI ranks by splitting the pair index space
+ *
+ * Every rank holds all elements, as when replicating the data, but visits only a contiguous
+ * share of the linear pair indices. Random access pair views unrank the start of the share in
+ * constant time, after which the share is processed in parallel on the rank as usual. Scalar
+ * results are summed with `MPI_Allreduce`. Per element results, e.g. forces, are either
+ * all-reduced or, if each rank only needs its own block of elements, reduce-scattered.
+ * The partitioning does not need MPI and is always available; the drivers are defined when
+ * `<mpi.h>` is found.
+ *
+ * Example:
+ *
+ * ~~~ cpp
+ * double u = Distributed::reduce_pairs(MPI_COMM_WORLD, std::execution::par, internal_pairs(v), 0.0,
+ *                                      [](auto pair) { auto [a, b] = pair; return energy(a, b); });
+ * Distributed::reduce_pairs_symmetric(MPI_COMM_WORLD, std::execution::par, v, &Particle::force, force);
+ * ~~~
+ */
+namespace Distributed {
+
+using PairwiseIterator::index_range;
+
+/** Share of rank `rank` out of `size` ranks of the index range [0,n); contiguous and equal +/- 1 */
+inline index_range rank_range(std::size_t n, int rank, int size) {
+    const auto r = static_cast<std::size_t>(rank), s = static_cast<std::size_t>(size);
+    const auto first = r * (n / s) + std::min(r, n % s);
+    return {first, first + n / s + (r < n % s ? 1 : 0)};
+}
+
+/** Contiguous part of a random access pair view, itself a random access pair view */
+template <class Iterator> class subrange {
+    Iterator first, last;
+
+  public:
+    subrange(Iterator first, Iterator last) : first(first), last(last) {}
+    Iterator begin() const { return first; }
+    Iterator end() const { return last; }
+    std::size_t size() const { return static_cast<std::size_t>(std::distance(first, last)); }
+};
+
+/** Pairs of `pairs` visited by `rank` out of `size` ranks */
+template <class Pairs> auto local_pairs(Pairs &&pairs, int rank, int size) {
+    using iterator = decltype(pairs.begin());
+    static_assert(std::is_base_of<std::random_access_iterator_tag,
+                                  typename std::iterator_traits<iterator>::iterator_category>::value,
+                  "pair view must be random access");
+    auto range = rank_range(pairs.size(), rank, size);
+    auto first = pairs.begin();
+    return subrange<iterator>(first + range.first, first + range.second);
+}
+
+#ifdef PAIRS_WITH_MPI
+/** How per element results are combined across ranks */
+enum class collective {
+    allreduce,     // all ranks get all elements
+    reduce_scatter // each rank gets its `rank_range(v.size(), rank, size)` block of elements only
+};
+
+/** MPI type and number of components of an arithmetic type or a fixed size Eigen object */
+template <class T, class = void> struct mpi_components {
+    using scalar = typename T::Scalar;
+    static constexpr int count = sizeof(T) / sizeof(scalar);
+};
+template <class T> struct mpi_components<T, std::enable_if_t<std::is_arithmetic<T>::value>> {
+    using scalar = T;
+    static constexpr int count = 1;
+};
+
+template <class T> MPI_Datatype mpi_type() {
+    if constexpr (std::is_same<T, double>::value)
+        return MPI_DOUBLE;
+    else if constexpr (std::is_same<T, float>::value)
+        return MPI_FLOAT;
+    else if constexpr (std::is_same<T, long double>::value)
+        return MPI_LONG_DOUBLE;
+    else if constexpr (std::is_same<T, int>::value)
+        return MPI_INT;
+    else if constexpr (std::is_same<T, long>::value)
+        return MPI_LONG;
+    else if constexpr (std::is_same<T, long long>::value)
+        return MPI_LONG_LONG;
+    else if constexpr (std::is_same<T, unsigned long>::value)
+        return MPI_UNSIGNED_LONG;
+    else {
+        static_assert(std::is_same<T, unsigned long long>::value, "no MPI type for this scalar");
+        return MPI_UNSIGNED_LONG_LONG;
+    }
+}
+
+inline std::pair<int, int> rank_and_size(MPI_Comm comm) {
+    int rank = 0, size = 1;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    return {rank, size};
+}
+
+/**
+ * @brief `init` plus the sum of `fn` over all pairs of a random access pair view, across all ranks of `comm`
+ *
+ * Each rank reduces its share with `parallel_reduce_pairs(policy, ...)` and the partial sums are
+ * all-reduced, so all ranks return the same value. `T` is arithmetic or a fixed size Eigen object.
+ */
+template <class ExecutionPolicy, class Pairs, class T, class Function>
+T reduce_pairs(MPI_Comm comm, ExecutionPolicy &&policy, Pairs &&pairs, T init, Function fn) {
+    using components = mpi_components<T>;
+    const auto [rank, size] = rank_and_size(comm);
+    T sum = PairwiseIterator::parallel_reduce_pairs(std::forward<ExecutionPolicy>(policy),
+                                                    local_pairs(pairs, rank, size),
+                                                    PairwiseIterator::zero_value<T>(), std::plus<>(), fn);
+    MPI_Allreduce(MPI_IN_PLACE, reinterpret_cast<typename components::scalar *>(&sum), components::count,
+                  mpi_type<typename components::scalar>(), MPI_SUM, comm);
+    return init + sum;
+}
+
+/**
+ * @brief Distributed `reduce_pairs_symmetric()`: add `kernel(a, b)` to `a.*member` and subtract it from `b.*member`
+ *
+ * Each rank scatters its share of the internal pairs of `v` into a buffer of one accumulator per
+ * element, in parallel chunks as for the shared memory version, and the buffers are then summed
+ * across ranks. Buffers above `Arena::retain_limit` bytes are taken from the heap. With
+ * `collective::reduce_scatter`, only the rank's own block of elements is updated which halves the
+ * communication; the other elements are left untouched.
+ */
+template <class ExecutionPolicy, class T, class Member, class Kernel>
+void reduce_pairs_symmetric(MPI_Comm comm, ExecutionPolicy &&policy, T &v, Member member, Kernel kernel,
+                            collective mode = collective::allreduce,
+                            std::size_t chunks = std::max(1u, std::thread::hardware_concurrency())) {
+    using accumulator = std::decay_t<decltype(v[0].*member)>;
+    using components = mpi_components<accumulator>;
+    using scalar = typename components::scalar;
+    const auto [rank, size] = rank_and_size(comm);
+    const std::size_t n = v.size();
+    const auto share = rank_range(n * (n - (n > 0)) / 2, rank, size);
+
+    Arena::scope scope;
+    auto ranges = PairwiseIterator::split_range(share.second - share.first, chunks,
+                                                std::pmr::polymorphic_allocator<index_range>(scope.resource()));
+    const auto zero = PairwiseIterator::zero_value<accumulator>();
+    const std::size_t buffer_size = std::max<std::size_t>(1, ranges.size()) * n;
+    std::pmr::vector<accumulator> buffers(buffer_size, zero, scope.resource(buffer_size * sizeof(accumulator)));
+    std::for_each(policy, ranges.begin(), ranges.end(), [&](const auto &range) {
+        const index_range pairs = {share.first + range.first, share.first + range.second};
+        PairwiseIterator::scatter_pairs_symmetric(v, kernel, pairs, buffers.data() + (&range - ranges.data()) * n);
+    });
+    for (std::size_t c = 1; c < ranges.size(); c++) // merge chunks into the first buffer
+        for (std::size_t i = 0; i < n; i++)
+            buffers[i] += buffers[c * n + i];
+
+    auto *data = reinterpret_cast<scalar *>(buffers.data());
+    const auto type = mpi_type<scalar>();
+    index_range own = {0, n};
+    if (mode == collective::allreduce)
+        MPI_Allreduce(MPI_IN_PLACE, data, static_cast<int>(n) * components::count, type, MPI_SUM, comm);
+    else {
+        std::vector<int> counts(size);
+        for (int r = 0; r < size; r++) {
+            auto block = rank_range(n, r, size);
+            counts[r] = static_cast<int>(block.second - block.first) * components::count;
+        }
+        own = rank_range(n, rank, size);
+        MPI_Reduce_scatter(MPI_IN_PLACE, data, counts.data(), type, MPI_SUM, comm); // own block comes first
+        std::copy_backward(buffers.begin(), buffers.begin() + (own.second - own.first), buffers.begin() + own.second);
+    }
+    for (auto i = own.first; i < own.second; i++)
+        v[i].*member += buffers[i];
+}
+#endif
+
+} // namespace Distributed
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE("mpi_pairs") {
+    using namespace Distributed;
+    std::vector<int> v(101);
+    std::iota(v.begin(), v.end(), 0);
+    auto pairs = PairwiseIterator::internal_pairs(v);
+    for (int size : {1, 3, 7}) { // shares of all ranks cover the pairs once
+        std::size_t cnt = 0, next = 0;
+        long sum = 0;
+        for (int rank = 0; rank < size; rank++) {
+            auto range = rank_range(pairs.size(), rank, size);
+            CHECK(range.first == next);
+            next = range.second;
+            for (auto [i, j] : local_pairs(pairs, rank, size)) {
+                sum += i * j;
+                cnt++;
+            }
+        }
+        CHECK(cnt == pairs.size());
+        CHECK(sum == 12582075L); // sum of i * j over i < j
+    }
+    CHECK(rank_range(2, 2, 3).first == rank_range(2, 2, 3).second); // more ranks than work
+
+#ifdef PAIRS_WITH_MPI
+    int initialized = 0;
+    MPI_Initialized(&initialized);
+    if (not initialized) {
+        MPI_Init(nullptr, nullptr); // a single rank unless started by mpirun
+        std::atexit([] { MPI_Finalize(); });
+    }
+    const auto [rank, size] = rank_and_size(MPI_COMM_WORLD);
+    auto product = [](auto pair) { return long(std::get<0>(pair) * std::get<1>(pair)); };
+    CHECK(reduce_pairs(MPI_COMM_WORLD, std::execution::par, pairs, 10L, product) == 12582085L);
+
+    struct particle {
+        double x;
+        Eigen::Vector2d force = Eigen::Vector2d::Zero();
+    };
+    std::vector<particle> particles(60);
+    for (std::size_t i = 0; i < particles.size(); i++)
+        particles[i].x = std::sin(i);
+    auto kernel = [](const particle &a, const particle &b) { return Eigen::Vector2d(a.x - b.x, 1.0); };
+    auto expected = particles;
+    PairwiseIterator::reduce_pairs_symmetric(expected, &particle::force, kernel);
+
+    for (auto mode : {collective::allreduce, collective::reduce_scatter}) {
+        auto copy = particles;
+        reduce_pairs_symmetric(MPI_COMM_WORLD, std::execution::par, copy, &particle::force, kernel, mode, 3);
+        auto own = mode == collective::allreduce ? index_range{0, copy.size()} : rank_range(copy.size(), rank, size);
+        for (std::size_t i = 0; i < copy.size(); i++) {
+            const bool updated = i >= own.first and i < own.second;
+            CHECK(copy[i].force.isApprox(updated ? expected[i].force : Eigen::Vector2d::Zero(), 1e-12));
+        }
+    }
+#endif
+}
+#endif
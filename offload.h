@@ -0,0 +1,177 @@
+/*
+ *  Copyright (C) 2020-present  Mikael Lund (github.com/mlund/cpptricks)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include "pairwise_iterator.h"
+#include <cmath>
+#include <cstddef>
+#include <execution>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+#ifdef __CUDACC__
+#define OFFLOAD_KERNEL __host__ __device__
+#else
+#define OFFLOAD_KERNEL
+#endif
+
+/**
+ * @brief All-pairs loops behind a backend switch, for kernels that may later run on a device
+ *
+ * The elements are a contiguous container of trivially copyable structures, e.g. a vector of
+ * `Eigen::Vector4d` holding position and charge or a packed gather of the members needed.
+ * Kernels either take two elements by const reference or, like the kernels of
+ * `parallel_reduce_pairs()`, one tuple of two references. Marking them `OFFLOAD_KERNEL`, and
+ * writing them without captures, keeps them usable as `__host__ __device__` lambdas under `nvcc`:
+ *
+ * ~~~ cpp
+ * auto coulomb = [] OFFLOAD_KERNEL(const Eigen::Vector4d &a, const Eigen::Vector4d &b) {
+ *     return a[3] * b[3] / (a.head<3>() - b.head<3>()).norm();
+ * };
+ * auto where = Offload::device_available() ? Offload::backend::device : Offload::backend::host;
+ * double energy = Offload::reduce_pairs(where, elements, 0.0, coulomb);
+ * ~~~
+ *
+ * Only the host backend is implemented: it runs `parallel_reduce_pairs()` and
+ * `reduce_pairs_symmetric()` with `std::execution::par`. `device_available()` is false and asking
+ * for `backend::device` throws, so callers can be written against the final interface now.
+ */
+namespace Offload {
+
+enum class backend { host, device };
+
+/** Calls a kernel taking either `(a, b)` or a tuple of references to `a` and `b` */
+template <class Kernel> struct pair_kernel {
+    Kernel kernel;
+    template <class A, class B> OFFLOAD_KERNEL auto operator()(const A &a, const B &b) const {
+        if constexpr (std::is_invocable<const Kernel &, const A &, const B &>::value)
+            return kernel(a, b);
+        else
+            return kernel(std::tuple<const A &, const B &>(a, b));
+    }
+};
+template <class Kernel> pair_kernel(Kernel) -> pair_kernel<Kernel>;
+
+/** True if a device backend is available; none is implemented yet */
+inline bool device_available() { return false; }
+
+inline void require_device() {
+    if (not device_available())
+        throw std::runtime_error("Offload: no device backend; use backend::host");
+}
+
+/** `init` plus the sum of `kernel(a, b)` over all unique pairs of elements */
+template <class Elements, class T, class Kernel>
+T reduce_pairs(backend where, const Elements &elements, T init, Kernel user_kernel) {
+    using element = std::decay_t<decltype(*elements.data())>;
+    static_assert(std::is_trivially_copyable<element>::value, "elements must be trivially copyable");
+    if (where != backend::host)
+        require_device();
+    const pair_kernel kernel{user_kernel};
+    auto on_pair = [&](const auto &pair) { return kernel(std::get<0>(pair), std::get<1>(pair)); };
+    return PairwiseIterator::parallel_reduce_pairs(std::execution::par, PairwiseIterator::internal_pairs(elements),
+                                                   init, std::plus<>(), on_pair);
+}
+
+/**
+ * @brief Add `kernel(a_i, a_j)` over all j != i to `out[i]`, e.g. to sum pair forces
+ *
+ * The kernel must be antisymmetric, `kernel(a, b) == -kernel(b, a)`, as for forces: each pair is
+ * evaluated once and Newton's third law is applied via `reduce_pairs_symmetric()`.
+ */
+template <class Elements, class Accumulators, class Kernel>
+void accumulate_pairs(backend where, const Elements &elements, Accumulators &out, Kernel user_kernel) {
+    using element = std::decay_t<decltype(*elements.data())>;
+    using accumulator = std::decay_t<decltype(*out.data())>;
+    static_assert(std::is_trivially_copyable<element>::value and std::is_trivially_copyable<accumulator>::value,
+                  "elements and accumulators must be trivially copyable");
+    if (elements.size() != out.size())
+        throw std::invalid_argument("Offload: one accumulator per element is needed");
+    if (where != backend::host)
+        require_device();
+    const pair_kernel kernel{user_kernel};
+    struct slot {
+        element value;
+        accumulator sum;
+    };
+    std::vector<slot> slots(elements.size());
+    for (std::size_t i = 0; i < slots.size(); i++)
+        slots[i] = {elements[i], out[i]};
+    auto slot_kernel = [&](const slot &a, const slot &b) { return kernel(a.value, b.value); };
+    PairwiseIterator::reduce_pairs_symmetric(std::execution::par, slots, &slot::sum, slot_kernel);
+    for (std::size_t i = 0; i < slots.size(); i++)
+        out[i] = slots[i].sum;
+}
+
+} // namespace Offload
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE("offload") {
+    using namespace Offload;
+    struct charge {
+        double x, q;
+    };
+    std::vector<charge> v(300);
+    for (std::size_t i = 0; i < v.size(); i++)
+        v[i] = {std::sin(i) * 10, i % 2 ? 1.0 : -1.0};
+    auto energy = [] OFFLOAD_KERNEL(const charge &a, const charge &b) { return a.q * b.q / std::fabs(a.x - b.x); };
+    auto force = [] OFFLOAD_KERNEL(const charge &a, const charge &b) {
+        const double r = a.x - b.x;
+        return a.q * b.q * r / std::fabs(r * r * r);
+    };
+    double expected = 0;
+    std::vector<double> expected_force(v.size(), 1.0); // accumulators keep their initial value
+    for (std::size_t i = 0; i < v.size(); i++)
+        for (std::size_t j = 0; j < v.size(); j++)
+            if (i != j) {
+                expected += i < j ? energy(v[i], v[j]) : 0.0;
+                expected_force[i] += force(v[i], v[j]);
+            }
+
+    const auto where = backend::host;
+    CHECK(reduce_pairs(where, v, 1.0, energy) == doctest::Approx(expected + 1.0));
+    std::vector<double> f(v.size(), 1.0);
+    accumulate_pairs(where, v, f, force);
+    for (std::size_t i = 0; i < v.size(); i++)
+        CHECK(f[i] == doctest::Approx(expected_force[i]));
+    std::vector<charge> empty;
+    CHECK(reduce_pairs(where, empty, 2.0, energy) == 2.0);
+
+    // the kernel of the parallel pair drivers, taking a tuple
+    auto energy_of_pair = [] OFFLOAD_KERNEL(const auto &pair) {
+        const auto &[a, b] = pair;
+        return a.q * b.q / std::fabs(a.x - b.x);
+    };
+    const double driver = PairwiseIterator::parallel_reduce_pairs(
+        std::execution::par, PairwiseIterator::internal_pairs(v), 1.0, std::plus<>(), energy_of_pair);
+    CHECK(reduce_pairs(where, v, 1.0, energy_of_pair) == doctest::Approx(driver));
+    auto force_of_pair = [] OFFLOAD_KERNEL(const auto &pair) {
+        const auto &[a, b] = pair;
+        const double r = a.x - b.x;
+        return a.q * b.q * r / std::fabs(r * r * r);
+    };
+    std::vector<double> g(v.size(), 1.0);
+    accumulate_pairs(where, v, g, force_of_pair);
+    CHECK(g[7] == doctest::Approx(expected_force[7]));
+    CHECK(not device_available());
+    CHECK_THROWS_AS(reduce_pairs(backend::device, v, 0.0, energy), std::runtime_error);
+    CHECK_THROWS_AS(accumulate_pairs(backend::device, v, g, force), std::runtime_error);
+    std::vector<double> wrong_size(3);
+    CHECK_THROWS_AS(accumulate_pairs(backend::host, v, wrong_size, force), std::invalid_argument);
+}
+#endif
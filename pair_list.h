@@ -0,0 +1,517 @@
+/*
+ *  Copyright (C) 2020-present  Mikael Lund (github.com/mlund/cpptricks)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define PAIR_LIST_MMAP
+#endif
+
+namespace PairwiseIterator {
+
+/**
+ * @brief Compact, immutable list of unique index pairs (i<j) in compressed sparse row form
+ *
+ * For each row i, the partners j>i are stored in ascending order as differences to the
+ * previous partner (the first one relative to i) using `Delta`, 16 or 32 bit unsigned integers.
+ * A difference too large for `Delta` is written as a zero followed by the 32 bit value.
+ * Rows start at 64 bit offsets into this stream. For neighbor lists, where partners are
+ * close in index, this takes 2 bytes per pair with 16 bit deltas rather than 16 bytes for
+ * `std::pair<size_t, size_t>`.
+ *
+ * The list can be saved to disk and loaded again, memory-mapped where POSIX `mmap` is
+ * available, so that restarting a job does not rebuild it. Copies share the storage.
+ * Iteration yields `std::pair` of indices, and `view(v)` gives tuples of references into
+ * a container like `internal_pairs`. Its rows act as the cells of `parallel_for_pairs(pool, ...)`.
+ *
+ * Example:
+ *
+ * ~~~ cpp
+ * auto list = pair_list<>::from_view(v.size(), cutoff_pairs(v, &Particle::pos, box, rcut));
+ * list.save("pairs.bin");
+ * ...
+ * auto list = pair_list<>::load("pairs.bin"); // near instant, pages are read on demand
+ * for (auto [a, b] : list.view(v))
+ *     ...
+ * ~~~
+ */
+template <class Delta = std::uint16_t> class pair_list {
+    static_assert(std::is_same<Delta, std::uint16_t>::value or std::is_same<Delta, std::uint32_t>::value,
+                  "deltas must be 16 or 32 bit unsigned integers");
+    static constexpr std::size_t escape_words = sizeof(std::uint32_t) / sizeof(Delta); // words after a zero
+
+    /** File layout: header, then `rows + 1` offsets, then `deltas` deltas */
+    struct header {
+        char magic[8] = {'C', 'P', 'P', 'T', 'P', 'L', '1', '\0'};
+        std::uint32_t delta_bytes = sizeof(Delta);
+        std::uint32_t reserved = 0;
+        std::uint64_t rows = 0, pairs = 0, deltas = 0;
+    };
+
+    /** Owned or memory-mapped arrays; shared between copies */
+    struct storage {
+        std::vector<std::uint64_t> offset_buffer;
+        std::vector<Delta> delta_buffer;
+        const std::uint64_t *offsets = nullptr;
+        const Delta *deltas = nullptr;
+        header head;
+        void *map = nullptr; // mapped file, if any
+        std::size_t map_size = 0;
+        ~storage() {
+#ifdef PAIR_LIST_MMAP
+            if (map != nullptr)
+                munmap(map, map_size);
+#endif
+        }
+    };
+    std::shared_ptr<const storage> data;
+
+    /** Position in the delta stream of the pairs */
+    struct cursor {
+        const storage *s = nullptr;
+        std::size_t i = 0, j = 0, at = 0, pos = 0; // current pair; where its delta starts; next delta
+
+        /** First pair in row `row` or any later row */
+        cursor(const storage *s, std::size_t row) : s(s), i(row), j(row), at(s->offsets[row]), pos(at) { next_row(); }
+        cursor(const storage *s) : s(s), i(s->head.rows), at(s->head.deltas), pos(at) {} // one past last pair
+        void next_row() {
+            while (i < s->head.rows and pos == s->offsets[i + 1]) // skip empty rows
+                j = ++i;
+            if (i < s->head.rows)
+                decode();
+            else
+                at = pos; // past the last pair
+        }
+        void decode() {
+            at = pos;
+            std::size_t d = s->deltas[pos++];
+            if (d == 0) { // escaped large difference
+                if (pos + escape_words > s->offsets[i + 1])
+                    throw std::runtime_error("pair_list: escape crosses the end of a row; corrupt file?");
+                std::uint32_t value;
+                std::memcpy(&value, s->deltas + pos, sizeof(value));
+                pos += escape_words;
+                d = value;
+            }
+            j += d;
+        }
+        void advance() {
+            if (pos == s->offsets[i + 1]) {
+                j = ++i;
+                next_row();
+            } else
+                decode();
+        }
+    };
+
+  public:
+    using index_pair = std::pair<std::size_t, std::size_t>;
+
+    /** Forward iterator over the index pairs */
+    class iterator {
+        cursor c;
+
+      public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = index_pair;
+        using reference = index_pair;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+
+        iterator(cursor c) : c(c) {}
+        inline index_pair operator*() const { return {c.i, c.j}; }
+        inline iterator &operator++() {
+            c.advance();
+            return *this;
+        }
+        inline bool operator==(const iterator &other) const { return c.at == other.c.at; }
+        inline bool operator!=(const iterator &other) const { return c.at != other.c.at; }
+    };
+
+    /** Pairs as tuples of (const) references into a random access container; see `pair_list::view()` */
+    template <class T, bool Const = std::is_const<T>::value> class container_view {
+        using iter = typename std::conditional<Const, typename T::const_iterator, typename T::iterator>::type;
+        using element = typename std::conditional<Const, typename T::const_reference, typename T::reference>::type;
+        const pair_list *list;
+        iter first;
+
+      public:
+        class iterator {
+            cursor c;
+            iter first;
+
+          public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = std::tuple<element, element>;
+            using reference = value_type;
+            using difference_type = std::ptrdiff_t;
+            using pointer = void;
+
+            iterator(cursor c, iter first) : c(c), first(first) {}
+            inline value_type operator*() const { return {first[c.i], first[c.j]}; }
+            /** Container indices of the current pair */
+            inline index_pair indices() const { return {c.i, c.j}; }
+            inline iterator &operator++() {
+                c.advance();
+                return *this;
+            }
+            inline bool operator==(const iterator &other) const { return c.at == other.c.at; }
+            inline bool operator!=(const iterator &other) const { return c.at != other.c.at; }
+        };
+        struct row_range {
+            iterator first, last;
+            iterator begin() const { return first; }
+            iterator end() const { return last; }
+        };
+
+        container_view(const pair_list &list, T &v) : list(&list), first(v.begin()) {}
+        iterator begin() const { return iterator(cursor(list->data.get(), 0), first); }
+        iterator end() const { return iterator(cursor(list->data.get()), first); }
+        std::size_t size() const { return list->size(); }
+        /** Number of rows; with `cell_pairs()` this lets `parallel_for_pairs(pool, ...)` schedule rows */
+        std::size_t cell_count() const { return list->rows(); }
+        row_range cell_pairs(std::size_t row) const {
+            return {iterator(cursor(list->data.get(), row), first), iterator(cursor(list->data.get(), row + 1), first)};
+        }
+    };
+
+  private:
+    /**
+     * Encode the pairs given by `for_each_pair(add)`, which calls `add(a, b)` for each pair and is
+     * invoked twice: once to count the partners of each row and once to collect them. Apart from the
+     * result, only 4 bytes per pair are needed for sorting the partners of each row.
+     */
+    template <class ForEachPair> void build(std::size_t n, ForEachPair for_each_pair) {
+        if (n >= (std::size_t(1) << 32))
+            throw std::length_error("pair_list: more than 2^32 elements");
+        auto s = std::make_shared<storage>();
+        std::vector<std::uint64_t> count(n + 1, 0); // partners per row, then row offsets
+        for_each_pair([&](std::size_t a, std::size_t b) {
+            if (a != b)
+                count[std::min(a, b) + 1]++;
+        });
+        for (std::size_t i = 0; i < n; i++)
+            count[i + 1] += count[i];
+        std::vector<std::uint32_t> partners(count[n]);
+        auto fill = count;
+        for_each_pair([&](std::size_t a, std::size_t b) {
+            if (a != b)
+                partners[fill[std::min(a, b)]++] = static_cast<std::uint32_t>(std::max(a, b));
+        });
+        fill = std::vector<std::uint64_t>();
+
+        s->offset_buffer.assign(n + 1, 0);
+        for (std::size_t i = 0; i < n; i++) {
+            auto first = partners.begin() + count[i], last = partners.begin() + count[i + 1];
+            std::sort(first, last);
+            last = std::unique(first, last);
+            std::size_t j = i;
+            for (auto it = first; it != last; ++it) {
+                auto d = static_cast<std::uint32_t>(*it - j);
+                if (d > std::numeric_limits<Delta>::max()) {
+                    s->delta_buffer.push_back(0);
+                    s->delta_buffer.resize(s->delta_buffer.size() + escape_words);
+                    std::memcpy(s->delta_buffer.data() + s->delta_buffer.size() - escape_words, &d, sizeof(d));
+                } else
+                    s->delta_buffer.push_back(static_cast<Delta>(d));
+                j = *it;
+                s->head.pairs++;
+            }
+            s->offset_buffer[i + 1] = s->delta_buffer.size();
+        }
+        s->head.rows = n;
+        s->head.deltas = s->delta_buffer.size();
+        s->offsets = s->offset_buffer.data();
+        s->deltas = s->delta_buffer.data();
+        data = std::move(s);
+    }
+
+  public:
+    /** Empty list */
+    pair_list() : pair_list(0, std::vector<index_pair>()) {}
+
+    /**
+     * @brief Build from a range of index pairs, each with `first` and `second` smaller than `n`
+     *
+     * The pairs may come in any order and orientation; they are stored as (min, max) and duplicates
+     * as well as self pairs are dropped.
+     */
+    template <class Pairs> pair_list(std::size_t n, const Pairs &pairs) {
+        build(n, [&](auto add) {
+            for (const auto &[a, b] : pairs)
+                add(a, b);
+        });
+    }
+
+    /**
+     * @brief Build from a pair view whose iterator has `indices()`, e.g. `cutoff_pairs` or `verlet_list`
+     *
+     * The view is iterated twice, counting and then collecting the partners of each row, so no
+     * intermediate list of index pairs is stored.
+     */
+    template <class View> static pair_list from_view(std::size_t n, const View &view) {
+        pair_list list;
+        list.build(n, [&](auto add) {
+            for (auto it = view.begin(); it != view.end(); ++it) {
+                const auto [a, b] = it.indices();
+                add(a, b);
+            }
+        });
+        return list;
+    }
+
+    std::size_t rows() const { return data->head.rows; }  // number of elements, i.e. rows
+    std::size_t size() const { return data->head.pairs; } // number of pairs
+    /** Bytes used by offsets and deltas */
+    std::size_t bytes() const { return (rows() + 1) * sizeof(std::uint64_t) + data->head.deltas * sizeof(Delta); }
+
+    iterator begin() const { return iterator(cursor(data.get(), 0)); }
+    iterator end() const { return iterator(cursor(data.get())); }
+
+    /** Pairs as tuples of references into `v`, which must have `rows()` elements */
+    template <class T> container_view<T> view(T &v) const { return container_view<T>(*this, v); }
+
+    /**
+     * @brief Write the list to a file; throws `std::runtime_error` on failure
+     *
+     * The data goes to a temporary file in the same directory. With POSIX it is flushed to disk with
+     * `fsync()` and then renamed, so an existing file is replaced atomically and lists loaded from it,
+     * possibly mapped by other processes, stay valid. Elsewhere the existing file is removed before
+     * the rename, so a failure in between leaves only the temporary file.
+     */
+    void save(const std::string &filename) const {
+#ifdef PAIR_LIST_MMAP
+        std::string temporary = filename + ".XXXXXX";
+        int fd = ::mkstemp(temporary.data());
+        if (fd >= 0)
+            ::fchmod(fd, 0644);
+        std::unique_ptr<std::FILE, int (*)(std::FILE *)> f(fd < 0 ? nullptr : ::fdopen(fd, "wb"), &std::fclose);
+        if (fd >= 0 and f == nullptr)
+            ::close(fd);
+#else
+        const std::string temporary = filename + ".tmp";
+        std::unique_ptr<std::FILE, int (*)(std::FILE *)> f(std::fopen(temporary.c_str(), "wb"), &std::fclose);
+#endif
+        if (f == nullptr)
+            throw std::runtime_error("pair_list: cannot create " + temporary);
+        bool ok = std::fwrite(&data->head, sizeof(header), 1, f.get()) == 1;
+        ok = ok and std::fwrite(data->offsets, sizeof(std::uint64_t), rows() + 1, f.get()) == rows() + 1;
+        ok = ok and std::fwrite(data->deltas, sizeof(Delta), data->head.deltas, f.get()) == data->head.deltas;
+        ok = ok and std::fflush(f.get()) == 0;
+#ifdef PAIR_LIST_MMAP
+        ok = ok and ::fsync(::fileno(f.get())) == 0; // on disk before the rename makes it visible
+#endif
+        ok = std::fclose(f.release()) == 0 and ok; // also reports delayed write errors
+#ifndef PAIR_LIST_MMAP
+        if (ok)
+            std::remove(filename.c_str()); // rename does not replace files on all platforms
+#endif
+        ok = ok and std::rename(temporary.c_str(), filename.c_str()) == 0;
+        if (not ok) {
+            std::remove(temporary.c_str());
+            throw std::runtime_error("pair_list: cannot write " + filename);
+        }
+    }
+
+    /**
+     * @brief Open a list written by `save()`; throws `std::runtime_error` on failure
+     *
+     * With POSIX `mmap` the file is mapped read-only and only the row offsets are read, to check
+     * that they start at zero, never decrease and end at the number of deltas; the deltas are read
+     * when used. Otherwise the file is read into memory.
+     */
+    static pair_list load(const std::string &filename) {
+        auto s = std::make_shared<storage>();
+        auto fail = [&](const char *reason) { return std::runtime_error("pair_list: " + filename + ": " + reason); };
+#ifdef PAIR_LIST_MMAP
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw fail("cannot open");
+        struct stat st;
+        if (::fstat(fd, &st) == 0 and st.st_size >= static_cast<off_t>(sizeof(header)))
+            s->map = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd); // the mapping stays valid
+        if (s->map == nullptr or s->map == MAP_FAILED) {
+            s->map = nullptr;
+            throw fail("cannot map");
+        }
+        s->map_size = st.st_size;
+        const auto *bytes = static_cast<const char *>(s->map);
+        std::memcpy(&s->head, bytes, sizeof(header));
+        const std::uint64_t size = s->map_size;
+#else
+        std::unique_ptr<std::FILE, int (*)(std::FILE *)> f(std::fopen(filename.c_str(), "rb"), &std::fclose);
+        if (f == nullptr or std::fseek(f.get(), 0, SEEK_END) != 0)
+            throw fail("cannot read");
+        const std::uint64_t size = std::max<long>(0, std::ftell(f.get()));
+        if (std::fseek(f.get(), 0, SEEK_SET) != 0 or std::fread(&s->head, sizeof(header), 1, f.get()) != 1)
+            throw fail("cannot read");
+#endif
+        if (std::memcmp(s->head.magic, header().magic, sizeof(header::magic)) != 0 or
+            s->head.delta_bytes != sizeof(Delta))
+            throw fail("not a pair list with this delta size");
+        const std::uint64_t body = size - sizeof(header), rows = s->head.rows, deltas = s->head.deltas;
+        if (rows >= body / sizeof(std::uint64_t) or deltas > body / sizeof(Delta) or
+            (rows + 1) * sizeof(std::uint64_t) + deltas * sizeof(Delta) != body) // checked before use
+            throw fail("truncated");
+#ifdef PAIR_LIST_MMAP
+        s->offsets = reinterpret_cast<const std::uint64_t *>(bytes + sizeof(header));
+        s->deltas = reinterpret_cast<const Delta *>(s->offsets + rows + 1);
+#else
+        s->offset_buffer.resize(rows + 1);
+        s->delta_buffer.resize(deltas);
+        if (std::fread(s->offset_buffer.data(), sizeof(std::uint64_t), rows + 1, f.get()) != rows + 1 or
+            std::fread(s->delta_buffer.data(), sizeof(Delta), deltas, f.get()) != deltas)
+            throw fail("cannot read");
+        s->offsets = s->offset_buffer.data();
+        s->deltas = s->delta_buffer.data();
+#endif
+        bool valid = s->offsets[0] == 0 and s->offsets[rows] == deltas;
+        for (std::size_t i = 0; valid and i < rows; i++)
+            valid = s->offsets[i] <= s->offsets[i + 1];
+        if (not valid)
+            throw fail("corrupt row offsets");
+        pair_list list;
+        list.data = std::move(s);
+        return list;
+    }
+};
+
+} // namespace PairwiseIterator
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+#include <filesystem>
+#include <numeric>
+#include <random>
+#include <set>
+
+TEST_CASE_TEMPLATE("pair_list", Delta, std::uint16_t, std::uint32_t) {
+    using namespace PairwiseIterator;
+    const std::size_t n = 70001;
+    std::mt19937 engine;
+    std::uniform_int_distribution<std::size_t> near(1, 100), any(0, n - 1);
+    std::vector<std::pair<std::size_t, std::size_t>> input;
+    for (std::size_t k = 0; k < 15 * n; k++) { // mostly near neighbors, some far apart
+        auto i = any(engine);
+        auto j = k % 100 == 0 ? any(engine) : std::min(n - 1, i + near(engine));
+        input.emplace_back(k % 2 ? i : j, k % 2 ? j : i); // both orientations
+    }
+    input.emplace_back(0, n - 1);   // needs an escape for 16 bit deltas
+    input.emplace_back(5, 5);       // self pairs are dropped
+    input.push_back(input.front()); // duplicate
+
+    std::set<std::pair<std::size_t, std::size_t>> expected;
+    for (auto [i, j] : input)
+        if (i != j)
+            expected.emplace(std::min(i, j), std::max(i, j));
+
+    pair_list<Delta> list(n, input);
+    CHECK(list.rows() == n);
+    CHECK(list.size() == expected.size());
+    CHECK(list.bytes() < list.size() * (sizeof(Delta) + 1)); // row offsets take less than a byte per pair
+    std::vector<std::pair<std::size_t, std::size_t>> decoded(list.begin(), list.end());
+    CHECK(std::equal(decoded.begin(), decoded.end(), expected.begin(), expected.end()));
+
+    SUBCASE("container view") {
+        std::vector<int> v(n, 0);
+        std::size_t cnt = 0;
+        for (auto [a, b] : list.view(v)) {
+            a++;
+            b++;
+            cnt++;
+        }
+        CHECK(cnt == list.size());
+        CHECK(std::accumulate(v.begin(), v.end(), std::size_t(0)) == 2 * list.size());
+        std::size_t in_rows = 0;
+        auto view = list.view(v);
+        for (std::size_t row = 0; row < view.cell_count(); row++)
+            in_rows += std::distance(view.cell_pairs(row).begin(), view.cell_pairs(row).end());
+        CHECK(in_rows == list.size());
+    }
+
+    SUBCASE("save and load") {
+        const auto unique = std::to_string(std::random_device()()) + "_" + std::to_string(sizeof(Delta));
+        auto filename = (std::filesystem::temp_directory_path() / ("cpptricks_pair_list_" + unique + ".bin")).string();
+        list.save(filename);
+        {
+            auto loaded = pair_list<Delta>::load(filename);
+            CHECK(loaded.size() == list.size());
+            CHECK(loaded.bytes() == list.bytes());
+            CHECK(std::equal(loaded.begin(), loaded.end(), list.begin(), list.end()));
+            auto copy = loaded; // shares the mapping
+            CHECK(*copy.begin() == *list.begin());
+            std::vector<std::pair<std::size_t, std::size_t>> one = {{1, 2}};
+            pair_list<Delta>(n, one).save(filename); // replace while mapped
+            CHECK(std::equal(loaded.begin(), loaded.end(), list.begin(), list.end()));
+            CHECK(pair_list<Delta>::load(filename).size() == 1);
+        }
+        CHECK_THROWS(list.save((std::filesystem::temp_directory_path() / unique / "missing" / "x.bin").string()));
+        using other = std::conditional_t<std::is_same<Delta, std::uint16_t>::value, std::uint32_t, std::uint16_t>;
+        CHECK_THROWS(pair_list<other>::load(filename)); // wrong delta size
+        std::filesystem::remove(filename);
+        CHECK_THROWS(pair_list<Delta>::load(filename));
+    }
+
+    SUBCASE("corrupt files") {
+        const auto unique = std::to_string(std::random_device()()) + "_" + std::to_string(sizeof(Delta));
+        auto filename = (std::filesystem::temp_directory_path() / ("cpptricks_corrupt_" + unique + ".bin")).string();
+        std::vector<std::pair<std::size_t, std::size_t>> two = {{0, 1}, {1, 2}}; // rows 0, 1 and 2
+        const std::size_t rows_at = 16, offsets_at = 40, deltas_at = offsets_at + 4 * sizeof(std::uint64_t);
+        auto corrupt = [&](std::size_t at, auto value) {
+            pair_list<Delta>(3, two).save(filename);
+            std::FILE *f = std::fopen(filename.c_str(), "r+b");
+            REQUIRE(f != nullptr);
+            std::fseek(f, static_cast<long>(at), SEEK_SET);
+            std::fwrite(&value, sizeof(value), 1, f);
+            std::fclose(f);
+        };
+        corrupt(0, std::uint8_t('C')); // unchanged
+        CHECK(pair_list<Delta>::load(filename).size() == 2);
+        corrupt(rows_at, std::uint64_t(1) << 60); // offsets beyond the file
+        CHECK_THROWS_AS(pair_list<Delta>::load(filename), std::runtime_error);
+        corrupt(offsets_at, std::uint64_t(1)); // first row does not start at zero
+        CHECK_THROWS_AS(pair_list<Delta>::load(filename), std::runtime_error);
+        corrupt(offsets_at + sizeof(std::uint64_t), std::uint64_t(1000)); // decreasing
+        CHECK_THROWS_AS(pair_list<Delta>::load(filename), std::runtime_error);
+        corrupt(offsets_at + 3 * sizeof(std::uint64_t), std::uint64_t(1)); // does not end at the deltas
+        CHECK_THROWS_AS(pair_list<Delta>::load(filename), std::runtime_error);
+        corrupt(deltas_at + sizeof(Delta), Delta(0)); // escape at the end of the last row
+        auto loaded = pair_list<Delta>::load(filename);
+        CHECK_THROWS_AS((void)std::distance(loaded.begin(), loaded.end()), std::runtime_error);
+        std::filesystem::remove(filename);
+    }
+
+    pair_list<Delta> empty;
+    CHECK(empty.size() == 0);
+    CHECK(empty.begin() == empty.end());
+}
+#endif
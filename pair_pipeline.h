@@ -0,0 +1,375 @@
+/*
+ *  Copyright (C) 2020-present  Mikael Lund (github.com/mlund/cpptricks)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include "pairwise_iterator.h"
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#define PAIRS_WITH_COROUTINES
+#endif
+
+/**
+ * @brief Pipelined pair loops: one thread searches pairs while another evaluates them
+ *
+ * `pipelined_pairs(pairs)` walks a pair view, e.g. `cutoff_pairs`, on a producer thread and hands
+ * the pairs over in batches through a bounded, lock-free single producer single consumer queue.
+ * The consumer, typically the thread driving a force kernel on its own pool, gets each batch as
+ * soon as it is full, so search and evaluation overlap and at most `depth` batches exist at a
+ * time instead of the whole pair list. Batches are recycled through a second queue and are not
+ * reallocated after the first round. With C++20, `generator<T>` gives lazy coroutine pair
+ * sources, e.g. a filtered view, that can be pipelined the same way.
+ *
+ * Example:
+ *
+ * ~~~ cpp
+ * auto pipeline = pipelined_pairs(cutoff_pairs(v, &Particle::pos, box, rcut));
+ * while (auto batch = pipeline.next())
+ *     std::for_each(std::execution::par, batch->begin(), batch->end(), [&](auto pair) { ... });
+ * ~~~
+ */
+namespace Pipeline {
+
+/**
+ * @brief Bounded, lock-free queue for exactly one producer thread and one consumer thread
+ *
+ * The capacity is rounded up to a power of two. Head and tail live on separate cache lines, and
+ * each side keeps a cached copy of the other's index so the shared line is only read when the
+ * queue looks full or empty.
+ */
+template <class T> class spsc_queue {
+    std::vector<T> slots;
+    std::size_t mask;
+    alignas(64) std::atomic<std::size_t> head{0}; // next slot to pop; written by the consumer
+    std::size_t cached_tail = 0;
+    alignas(64) std::atomic<std::size_t> tail{0}; // next slot to push; written by the producer
+    std::size_t cached_head = 0;
+
+    static std::size_t round_up(std::size_t n) {
+        std::size_t size = 1;
+        while (size < n)
+            size *= 2;
+        return size;
+    }
+
+  public:
+    explicit spsc_queue(std::size_t capacity) : slots(round_up(capacity)), mask(slots.size() - 1) {}
+    std::size_t capacity() const { return slots.size(); }
+
+    /** Producer side; false if the queue is full */
+    bool try_push(T value) {
+        const auto t = tail.load(std::memory_order_relaxed);
+        if (t - cached_head == slots.size()) {
+            cached_head = head.load(std::memory_order_acquire);
+            if (t - cached_head == slots.size())
+                return false;
+        }
+        slots[t & mask] = std::move(value);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    /** Consumer side; false if the queue is empty */
+    bool try_pop(T &value) {
+        const auto h = head.load(std::memory_order_relaxed);
+        if (h == cached_tail) {
+            cached_tail = tail.load(std::memory_order_acquire);
+            if (h == cached_tail)
+                return false;
+        }
+        value = std::move(slots[h & mask]);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    /** Blocking versions that yield while waiting */
+    void push(T value) {
+        while (not try_push(value))
+            std::this_thread::yield();
+    }
+    T pop() {
+        T value;
+        while (not try_pop(value))
+            std::this_thread::yield();
+        return value;
+    }
+};
+
+/**
+ * @brief Pairs of `Source` passed in batches from a producer thread to the calling thread
+ *
+ * `Source` is a pair view or any other input range of pairs; lvalues are referenced and must stay
+ * alive, rvalues are moved into the pipeline. The producer starts on construction. Each call to
+ * `next()` returns the next full batch (a `std::vector` of pairs) or nullptr at the end, and hands
+ * the previous batch back to the producer, so a batch is only valid until the following `next()`.
+ * An exception thrown by the producer is rethrown by `next()`. Destruction stops the producer.
+ */
+template <class Source> class pair_pipeline {
+  public:
+    using value_type = std::decay_t<decltype(*std::begin(std::declval<Source &>()))>;
+    using batch = std::vector<value_type>;
+
+  private:
+    Source source;
+    std::size_t batch_size;
+    std::vector<batch> batches;
+    spsc_queue<batch *> full, empty; // producer -> consumer; consumer -> producer
+    batch *current = nullptr;
+    std::exception_ptr error;
+    std::atomic<bool> stopped{false};
+    bool done = false;
+    std::thread producer;
+
+    void produce() {
+        try {
+            batch *b = empty.pop();
+            for (auto &&pair : source) {
+                b->emplace_back(pair);
+                if (b->size() == batch_size) {
+                    full.push(b);
+                    while (not empty.try_pop(b))
+                        if (stopped.load(std::memory_order_relaxed))
+                            return;
+                        else
+                            std::this_thread::yield();
+                    b->clear();
+                }
+            }
+            if (not b->empty())
+                full.push(b);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        full.push(nullptr); // end marker; the queue has room for all batches plus this
+    }
+
+  public:
+    pair_pipeline(Source &&source, std::size_t batch_size = 1024, std::size_t depth = 4)
+        : source(std::forward<Source>(source)), batch_size(batch_size), batches(depth), full(depth + 1),
+          empty(depth) {
+        assert(batch_size > 0 && depth > 0);
+        for (auto &b : batches) {
+            b.reserve(batch_size);
+            empty.push(&b);
+        }
+        producer = std::thread(&pair_pipeline::produce, this);
+    }
+    pair_pipeline(const pair_pipeline &) = delete;
+    pair_pipeline &operator=(const pair_pipeline &) = delete;
+
+    ~pair_pipeline() {
+        stopped.store(true, std::memory_order_relaxed);
+        if (producer.joinable())
+            producer.join();
+    }
+
+    /** Next batch of pairs, or nullptr when all pairs have been delivered */
+    const batch *next() {
+        if (done)
+            return nullptr;
+        if (current)
+            empty.push(current);
+        current = full.pop();
+        if (not current) {
+            done = true;
+            producer.join(); // also makes `error` visible
+            if (error)
+                std::rethrow_exception(error);
+        }
+        return current;
+    }
+
+    /** Call `fn` for every pair on the calling thread */
+    template <class Function> void for_each(Function fn) {
+        while (auto b = next())
+            for (auto &pair : *b)
+                fn(pair);
+    }
+};
+
+/** Start a `pair_pipeline` over `source`, with at most `depth` batches of `batch_size` pairs in flight */
+template <class Source>
+pair_pipeline<Source> pipelined_pairs(Source &&source, std::size_t batch_size = 1024, std::size_t depth = 4) {
+    return {std::forward<Source>(source), batch_size, depth};
+}
+
+#ifdef PAIRS_WITH_COROUTINES
+/**
+ * @brief Minimal `std::generator`-like coroutine returning values of type `T` with `co_yield`
+ *
+ * A single pass input range; yielded values live until the coroutine is resumed, and exceptions
+ * propagate to the caller when advancing.
+ */
+template <class T> class generator {
+  public:
+    struct promise_type {
+        const T *value = nullptr;
+        std::exception_ptr error;
+        generator get_return_object() { return generator(handle::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        std::suspend_always yield_value(const T &v) noexcept {
+            value = std::addressof(v);
+            return {};
+        }
+        void return_void() noexcept {}
+        void unhandled_exception() { error = std::current_exception(); }
+    };
+
+  private:
+    using handle = std::coroutine_handle<promise_type>;
+    handle coroutine;
+    explicit generator(handle h) : coroutine(h) {}
+
+    void resume() {
+        coroutine.resume();
+        if (coroutine.done() and coroutine.promise().error)
+            std::rethrow_exception(coroutine.promise().error);
+    }
+
+  public:
+    struct iterator {
+        using value_type = T;
+        using reference = const T &;
+        using pointer = const T *;
+        using difference_type = std::ptrdiff_t;
+        using iterator_category = std::input_iterator_tag;
+
+        generator *self = nullptr;
+        reference operator*() const { return *self->coroutine.promise().value; }
+        pointer operator->() const { return self->coroutine.promise().value; }
+        iterator &operator++() {
+            self->resume();
+            return *this;
+        }
+        void operator++(int) { ++*this; }
+        bool operator==(std::default_sentinel_t) const { return self->coroutine.done(); }
+    };
+
+    generator(generator &&other) noexcept : coroutine(std::exchange(other.coroutine, {})) {}
+    generator &operator=(generator &&other) noexcept {
+        std::swap(coroutine, other.coroutine);
+        return *this;
+    }
+    ~generator() {
+        if (coroutine)
+            coroutine.destroy();
+    }
+
+    iterator begin() {
+        resume();
+        return {this};
+    }
+    std::default_sentinel_t end() const { return {}; }
+};
+#endif
+
+} // namespace Pipeline
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE("pair_pipeline") {
+    using namespace Pipeline;
+    SUBCASE("spsc_queue") {
+        spsc_queue<int> queue(3);
+        CHECK(queue.capacity() == 4);
+        for (int i = 0; i < 4; i++)
+            CHECK(queue.try_push(i));
+        CHECK(not queue.try_push(4));
+        int value = -1;
+        CHECK(queue.try_pop(value));
+        CHECK(value == 0);
+        CHECK(queue.try_push(4));
+        long sum = 0;
+        std::thread consumer([&] {
+            for (int i = 1; i < 10000; i++)
+                sum += queue.pop();
+        });
+        for (int i = 5; i < 10000; i++)
+            queue.push(i);
+        consumer.join();
+        CHECK(sum == 49995000L);
+        CHECK(not queue.try_pop(value));
+    }
+    SUBCASE("pipelined_pairs") {
+        std::vector<int> v(150);
+        std::iota(v.begin(), v.end(), 0);
+        auto pairs = PairwiseIterator::internal_pairs(v);
+        long sum = 0, cnt = 0;
+        std::size_t batches = 0;
+        auto pipeline = pipelined_pairs(pairs, 100, 2); // 11175 pairs
+        while (auto batch = pipeline.next()) {
+            CHECK(batch->size() <= 100);
+            batches++;
+            for (auto [a, b] : *batch) {
+                sum += a * b;
+                cnt++;
+            }
+        }
+        CHECK(batches == 112);
+        CHECK(cnt == 11175);
+        CHECK(sum == 61883425L);
+        CHECK(pipeline.next() == nullptr);
+
+        std::vector<int> none;
+        auto empty = pipelined_pairs(PairwiseIterator::internal_pairs(none));
+        CHECK(empty.next() == nullptr);
+
+        pipelined_pairs(pairs, 10, 2); // stopped before consuming anything
+        long mutated = 0;
+        pipelined_pairs(PairwiseIterator::internal_pairs(v), 64).for_each([&](auto pair) {
+            std::get<1>(pair) += 0; // mutable references into `v`
+            mutated++;
+        });
+        CHECK(mutated == cnt);
+    }
+#ifdef PAIRS_WITH_COROUTINES
+    SUBCASE("generator") {
+        std::vector<int> v(150);
+        std::iota(v.begin(), v.end(), 0);
+        auto even = [](const std::vector<int> &v) -> generator<std::tuple<const int &, const int &>> {
+            for (auto [a, b] : PairwiseIterator::internal_pairs(v))
+                if ((a + b) % 2 == 0)
+                    co_yield {a, b};
+        };
+        long cnt = 0;
+        for (auto [a, b] : even(v)) {
+            CHECK((a + b) % 2 == 0);
+            cnt++;
+        }
+        CHECK(cnt == 5550);
+        long piped = 0;
+        pipelined_pairs(even(v), 128).for_each([&](auto) { piped++; });
+        CHECK(piped == cnt);
+
+        auto failing = []() -> generator<int> {
+            co_yield 1;
+            throw std::runtime_error("search failed");
+        };
+        auto pipeline = pipelined_pairs(failing());
+        CHECK_THROWS_AS(pipeline.next(), std::runtime_error);
+    }
+#endif
+}
+#endif
@@ -15,12 +15,70 @@
  *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 #pragma once
+#include "arena.h"
+#include "instrumentation.h"
+#include "work_stealing.h"
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <execution>
+#include <iterator>
+#include <memory_resource>
+#include <numeric>
+#include <optional>
+#include <stdexcept>
 #include <tuple>
 #include <type_traits>
 #include <typeinfo>
+#include <thread>
+#include <utility>
+#include <vector>
+#if __has_include(<version>)
+#include <version>
+#endif
+#ifdef __cpp_lib_ranges
+#include <ranges>
+#endif
 
 namespace PairwiseIterator {
 
+#ifdef __cpp_lib_ranges
+/** Base of views that should model `std::ranges::view` and compose with e.g. `std::views::filter` */
+using view_base = std::ranges::view_base;
+#else
+struct view_base {};
+#endif
+
+/** Iterator type of a (possibly const) container */
+template <class Container> using container_iterator = decltype(std::declval<Container &>().begin());
+
+/**
+ * @brief Maps a linear pair index to the corresponding (i,j) pair of an n-element container
+ *
+ * Pairs are enumerated row by row as in `internal_pairs`, i.e. k = i(2n-i-1)/2 + j-i-1
+ * with i<j. The inverse is found in constant time using the closed-form solution of
+ * the quadratic; the trailing loops merely guard against floating point round-off
+ * for very large n.
+ */
+inline std::pair<std::size_t, std::size_t> triangular_unrank(std::size_t k, std::size_t n) {
+    auto row_offset = [n](std::size_t i) { return i * (2 * n - i - 1) / 2; }; // first k of row i
+    double r = n - 2.0 - std::floor(std::sqrt(4.0 * n * (n - 1.0) - 8.0 * k - 7.0) / 2.0 - 0.5);
+    auto i = static_cast<std::size_t>(std::max(0.0, std::min(r, n - 2.0)));
+    while (i > 0 and row_offset(i) > k)
+        i--;
+    while (row_offset(i + 1) <= k)
+        i++;
+    return {i, k - row_offset(i) + i + 1};
+}
+
+/**
+ * @brief Tag selecting cache blocked (tiled) traversal of a pair view with tiles of B x B pairs
+ */
+template <std::size_t B> struct tile_t { static constexpr std::size_t size = B; };
+template <std::size_t B> inline constexpr tile_t<B> tile{};
+
 /**
  * @brief Iterator view to unique, self-avoiding pairs in a container
  *
@@ -28,6 +86,22 @@ namespace PairwiseIterator {
  * Deferencing the iterator yields a tuple with (const) references to the
  * two data elements.
  *
+ * For random access containers the iterator is itself random access: a linear pair
+ * index is mapped to (i,j) in constant time using `triangular_unrank()` so that
+ * `std::advance`, `std::distance` and `operator[]` do not walk the pairs.
+ * Other containers, e.g. `std::list`, get a forward iterator.
+ *
+ * By default, pairs are visited row by row so that for large containers each row evicts
+ * the previous one from the cache. Passing `tile<B>` instead visits the triangular matrix
+ * block by block, i.e. all pairs between the i-tile and the j-tile of B elements each,
+ * before moving on to the next j-tile. Both tiles then stay cache resident.
+ * The tiled iterator is a forward iterator and requires a random access container:
+ *
+ * ~~~ cpp
+ * for (auto [i,j] : internal_pairs(v, tile<256>))
+ *    ...
+ * ~~~
+ *
  * Example:
  *
  * ~~~ cpp
@@ -39,46 +113,205 @@ namespace PairwiseIterator {
  *
  * @todo: implement non-const version
  */
-template <class T, bool Const = std::is_const<T>::value> class internal_pairs {
+template <class T, bool Const = std::is_const<T>::value, std::size_t Tile = 0> class internal_pairs {
   private:
     T &vec;
-    struct iterator {
+    using iter = typename std::conditional<Const, typename T::const_iterator, typename T::iterator>::type;
+    using reference = typename std::conditional<Const, typename T::const_reference, typename T::reference>::type;
+
+    struct forward_iterator {
         // required for e.g. std::distance
-        using iter = typename std::conditional<Const, typename T::const_iterator, typename T::iterator>::type;
+        using iter = internal_pairs::iter;
         using pointer = void;
-        using reference = typename std::conditional<Const, typename T::const_reference, typename T::reference>::type;
+        using reference = internal_pairs::reference;
         using value_type = std::tuple<reference, reference>;
         using difference_type = std::ptrdiff_t;
         using iterator_category = std::forward_iterator_tag; // we can only move forward
 
         iter _end, i, j;
-        iterator(iter end, iter i, iter j) : _end(end), i(i), j(j){};
+        forward_iterator(iter end, iter i, iter j) : _end(end), i(i), j(j){};
         inline value_type operator*() { return {*i, *j}; }
-        inline bool operator!=(const iterator &other) const { return (i != other.i) or (j != other.j); }
-        inline iterator &operator++() {
+        inline bool operator!=(const forward_iterator &other) const { return (i != other.i) or (j != other.j); }
+        inline forward_iterator &operator++() {
             if (++j == _end)
                 j = std::next(++i);
             return *this;
         }
     };
 
+    struct random_access_iterator {
+        using iter = internal_pairs::iter;
+        using pointer = void;
+        using reference = internal_pairs::reference;
+        using value_type = std::tuple<reference, reference>;
+        using difference_type = std::ptrdiff_t;
+        using iterator_category = std::random_access_iterator_tag;
+
+        iter first;                                 // first element in container
+        difference_type n = 0, k = 0, i = 0, j = 0; // container size; linear pair index; pair indices
+
+        random_access_iterator() = default;
+        random_access_iterator(iter first, difference_type n, difference_type k) : first(first), n(n) { seek(k); }
+
+        inline void seek(difference_type k) {
+            this->k = k;
+            if (k < n * (n - 1) / 2) {
+                auto ij = triangular_unrank(k, n);
+                i = ij.first;
+                j = ij.second;
+            } else { // one iteration after last pair
+                i = n - 1;
+                j = n;
+            }
+        }
+        inline value_type operator*() const { return {first[i], first[j]}; }
+        inline value_type operator[](difference_type d) const { return *(*this + d); }
+        inline random_access_iterator &operator++() {
+            k++;
+            if (++j == n) {
+                i++;
+                j = i + 1;
+            }
+            return *this;
+        }
+        inline random_access_iterator &operator--() {
+            k--;
+            if (--j == i) {
+                i--;
+                j = n - 1;
+            }
+            return *this;
+        }
+        inline random_access_iterator operator++(int) {
+            auto tmp = *this;
+            ++*this;
+            return tmp;
+        }
+        inline random_access_iterator operator--(int) {
+            auto tmp = *this;
+            --*this;
+            return tmp;
+        }
+        inline random_access_iterator &operator+=(difference_type d) {
+            seek(k + d);
+            return *this;
+        }
+        inline random_access_iterator &operator-=(difference_type d) { return *this += -d; }
+        inline random_access_iterator operator+(difference_type d) const { return random_access_iterator(*this) += d; }
+        inline random_access_iterator operator-(difference_type d) const { return random_access_iterator(*this) -= d; }
+        friend inline random_access_iterator operator+(difference_type d, const random_access_iterator &it) {
+            return it + d;
+        }
+        inline difference_type operator-(const random_access_iterator &other) const { return k - other.k; }
+        inline bool operator==(const random_access_iterator &other) const { return k == other.k; }
+        inline bool operator!=(const random_access_iterator &other) const { return k != other.k; }
+        inline bool operator<(const random_access_iterator &other) const { return k < other.k; }
+        inline bool operator>(const random_access_iterator &other) const { return k > other.k; }
+        inline bool operator<=(const random_access_iterator &other) const { return k <= other.k; }
+        inline bool operator>=(const random_access_iterator &other) const { return k >= other.k; }
+    };
+
+    struct tiled_iterator {
+        using iter = internal_pairs::iter;
+        using pointer = void;
+        using reference = internal_pairs::reference;
+        using value_type = std::tuple<reference, reference>;
+        using difference_type = std::ptrdiff_t;
+        using iterator_category = std::forward_iterator_tag;
+
+        iter first;
+        difference_type n, i, j;      // container size; pair indices
+        difference_type bi, bj;       // first index of the current i- and j-tiles
+        difference_type i_end, j_end; // one past last index of the current i- and j-tiles
+
+        tiled_iterator(iter first, difference_type n, bool at_end) : first(first), n(n) {
+            if (at_end or n < 2)
+                i = j = bi = bj = n;
+            else {
+                bi = bj = i = 0;
+                j = 1;
+                i_end = j_end = std::min<difference_type>(Tile, n);
+                if (j == j_end) // single element tiles leave the diagonal tile empty
+                    next_row();
+            }
+        }
+        inline value_type operator*() { return {first[i], first[j]}; }
+        inline bool operator!=(const tiled_iterator &other) const { return (i != other.i) or (j != other.j); }
+        inline tiled_iterator &operator++() {
+            if (++j == j_end)
+                next_row();
+            return *this;
+        }
+
+      private:
+        void next_row() {
+            while (true) {
+                if (++i == i_end) { // move to the next tile
+                    bj += Tile;
+                    if (bj >= n) {
+                        bi += Tile;
+                        bj = bi;
+                    }
+                    if (bi >= n) {
+                        i = j = bi = bj = n; // one iteration after last pair
+                        return;
+                    }
+                    i = bi;
+                    i_end = std::min<difference_type>(bi + Tile, n);
+                    j_end = std::min<difference_type>(bj + Tile, n);
+                }
+                j = (bi == bj) ? i + 1 : bj; // diagonal tiles are triangular
+                if (j < j_end)
+                    return;
+            }
+        }
+    };
+
+    static constexpr bool random_access =
+        std::is_base_of<std::random_access_iterator_tag, typename std::iterator_traits<iter>::iterator_category>::value;
+    static_assert(Tile == 0 or random_access, "tiled traversal requires a random access container");
+
+  public:
+    using iterator = typename std::conditional<
+        Tile != 0, tiled_iterator,
+        typename std::conditional<random_access, random_access_iterator, forward_iterator>::type>::type;
+
+  private:
+    iterator first_pair() const {
+        if constexpr (Tile != 0)
+            return iterator(vec.begin(), vec.size(), false);
+        else if constexpr (random_access)
+            return iterator(vec.begin(), vec.size(), 0);
+        else
+            return iterator(vec.end(), vec.begin(), std::next(vec.begin()));
+    }
+    iterator past_last_pair() const {
+        if constexpr (Tile != 0)
+            return iterator(vec.begin(), vec.size(), true);
+        else if constexpr (random_access)
+            return iterator(vec.begin(), vec.size(), size());
+        else
+            return iterator(vec.end(), std::prev(vec.end()), vec.end());
+    }
+
   public:
     internal_pairs(T &vec) : vec(vec) {}
+    internal_pairs(T &vec, tile_t<Tile>) : vec(vec) {}
 
     template <bool _Const = Const> std::enable_if_t<_Const, iterator> begin() const {
-        return iterator(vec.end(), vec.begin(), std::next(vec.begin()));
+        return first_pair();
     } // first pair
 
     template <bool _Const = Const> std::enable_if_t<_Const, iterator> end() const {
-        return iterator(vec.end(), std::prev(vec.end()), vec.end());
+        return past_last_pair();
     } // one iteration after last pair
 
     template <bool _Const = Const> std::enable_if_t<not _Const, iterator> begin() {
-        return iterator(vec.end(), vec.begin(), std::next(vec.begin()));
+        return first_pair();
     } // first pair
 
     template <bool _Const = Const> std::enable_if_t<not _Const, iterator> end() {
-        return iterator(vec.end(), std::prev(vec.end()), vec.end());
+        return past_last_pair();
     } // one iteration after last pair
 
     size_t size() const { return vec.size() * (vec.size() - 1) / 2; }
@@ -122,6 +355,85 @@ TEST_CASE_TEMPLATE("internal_pairs", T, std::vector<int>, std::list<int>, std::a
 }
 #endif
 
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE("triangular_unrank") {
+    for (std::size_t n = 2; n < 40; n++) {
+        std::size_t k = 0;
+        for (std::size_t i = 0; i < n; i++)
+            for (std::size_t j = i + 1; j < n; j++)
+                CHECK(triangular_unrank(k++, n) == std::pair(i, j));
+    }
+    std::size_t n = 100000, k = n * (n - 1) / 2 - 1; // last pair of a large container
+    CHECK(triangular_unrank(k, n) == std::pair(n - 2, n - 1));
+    CHECK(triangular_unrank(k - 2, n) == std::pair(n - 3, n - 2));
+    CHECK(triangular_unrank(n - 2, n) == std::pair(std::size_t(0), n - 1));
+}
+
+TEST_CASE_TEMPLATE("internal_pairs_random_access", T, std::vector<int>, std::array<int, 5>) {
+    T vec = {0, 1, 2, 3, 4};
+    internal_pairs pairs(vec);
+    using iterator = decltype(pairs.begin());
+    CHECK(std::is_same<typename std::iterator_traits<iterator>::iterator_category,
+                       std::random_access_iterator_tag>::value);
+    CHECK(pairs.end() - pairs.begin() == 10);
+
+    auto it = pairs.begin();
+    CHECK(it[3] == std::tuple(0, 4));
+    CHECK(it[4] == std::tuple(1, 2));
+    CHECK(*(it + 9) == std::tuple(3, 4));
+    it += 7;
+    CHECK(*it == std::tuple(2, 3));
+    CHECK(*(--it) == std::tuple(1, 4));
+    CHECK(*(it - 3) == std::tuple(0, 4));
+    CHECK(it - pairs.begin() == 6);
+    CHECK(pairs.begin() < it);
+    CHECK(it <= pairs.end());
+    CHECK(pairs.begin() + 10 == pairs.end());
+    CHECK(--pairs.end() == pairs.begin() + 9);
+
+    // incremental and random access traversal must agree
+    std::ptrdiff_t k = 0;
+    for (auto it = pairs.begin(); it != pairs.end(); ++it, ++k)
+        CHECK(*it == pairs.begin()[k]);
+    CHECK(k == 10);
+}
+#endif
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE("internal_pairs_tiled") {
+    std::vector<int> vec = {0, 1, 2, 3, 4};
+    std::vector<std::tuple<int, int>> visited;
+    for (auto [i, j] : internal_pairs(vec, tile<2>))
+        visited.emplace_back(i, j);
+    CHECK(visited == std::vector<std::tuple<int, int>>{
+                         {0, 1}, {0, 2}, {0, 3}, {1, 2}, {1, 3}, {0, 4}, {1, 4}, {2, 3}, {2, 4}, {3, 4}});
+
+    auto [i, j] = *internal_pairs(vec, tile<2>).begin();
+    i = -1; // modify original vector
+    CHECK(vec.front() == -1);
+
+    // all tile sizes must visit every pair exactly once
+    auto check_tiling = [](auto tile) {
+        for (int n = 0; n < 20; n++) {
+            std::vector<int> v(n);
+            std::iota(v.begin(), v.end(), 0);
+            std::vector<std::tuple<int, int>> tiled, untiled;
+            for (auto pair : internal_pairs(v, tile))
+                tiled.push_back(pair);
+            for (auto pair : internal_pairs(v))
+                untiled.push_back(pair);
+            CHECK(tiled.size() == internal_pairs(v, tile).size());
+            std::sort(tiled.begin(), tiled.end());
+            CHECK(tiled == untiled);
+        }
+    };
+    check_tiling(tile<1>);
+    check_tiling(tile<3>);
+    check_tiling(tile<4>);
+    check_tiling(tile<64>);
+}
+#endif
+
 #ifdef RANGES_V3_VIEW_ZIP_HPP
 #ifdef DOCTEST_LIBRARY_INCLUDED
 TEST_CASE("internal_pairs_index") {
@@ -152,81 +464,2009 @@ TEST_CASE("internal_pairs_index") {
 #endif
 
 /**
- * Constant view to pairs in two containers
- * Calling `std::distance` is of O(N) complexity while `size` has constant complexity
+ * @brief View to the pairs of one element `k` with all other elements of a random access container
+ *
+ * Yields tuples of (const) references `(v[k], v[j])` for j != k in increasing j, as needed to
+ * update the energy of a single moved particle in O(N). The iterator is random access so the
+ * view can also be given to `parallel_for_pairs`. Created with `pairs_with(v, k)`.
  */
-template <class Iter1, class Iter2> class cartesian_product {
-  private:
+template <class T, bool Const = std::is_const<T>::value> class pairs_with_view : public view_base {
+    using iter = typename std::conditional<Const, typename T::const_iterator, typename T::iterator>::type;
+    using ref = typename std::conditional<Const, typename T::const_reference, typename T::reference>::type;
+    static_assert(std::is_base_of<std::random_access_iterator_tag,
+                                  typename std::iterator_traits<iter>::iterator_category>::value,
+                  "pairs_with requires a random access container");
+    iter first;
+    std::size_t n = 0, k = 0;
+
+  public:
     struct iterator {
-        // these five are useful for stl
-        using iterator_category = std::forward_iterator_tag; // we can only move forward
-        using value_type = std::tuple<const typename Iter1::value_type &, const typename Iter2::value_type &>;
+        using value_type = std::tuple<ref, ref>;
+        using reference = value_type;
+        using pointer = void;
         using difference_type = std::ptrdiff_t;
-        using reference = value_type &;
-        using pointer = value_type *;
+        using iterator_category = std::random_access_iterator_tag;
 
-        Iter1 pos1, last1;
-        Iter2 pos2, first2, last2;
-        iterator(Iter1 first1, Iter1 last1, Iter2 first2, Iter2 last2)
-            : pos1(first1), last1(last1), pos2(first2), first2(first2), last2(last2) {}
+        iter first;
+        std::size_t k = 0;
+        difference_type m = 0; // position among the n - 1 partners
 
-        inline value_type operator*() { return {*pos1, *pos2}; }
-        inline bool operator!=(const iterator &other) const { return (pos1 != other.pos1) or (pos2 != other.pos2); }
+        inline std::size_t partner() const {
+            const auto j = static_cast<std::size_t>(m);
+            return j < k ? j : j + 1;
+        }
+        inline value_type operator*() const { return {first[k], first[partner()]}; }
+        inline value_type operator[](difference_type d) const { return *(*this + d); }
+        /** Container indices of the current pair, `k` first */
+        inline std::pair<std::size_t, std::size_t> indices() const { return {k, partner()}; }
         inline iterator &operator++() {
-            if (++pos2 == last2) {
-                pos2 = first2;
-                pos1++;
-                if (pos1 == last1)
-                    pos2 = last2;
-            }
+            ++m;
+            return *this;
+        }
+        inline iterator &operator--() {
+            --m;
+            return *this;
+        }
+        inline iterator operator++(int) { return {first, k, m++}; }
+        inline iterator operator--(int) { return {first, k, m--}; }
+        inline iterator &operator+=(difference_type d) {
+            m += d;
             return *this;
         }
+        inline iterator &operator-=(difference_type d) { return *this += -d; }
+        inline iterator operator+(difference_type d) const { return {first, k, m + d}; }
+        inline iterator operator-(difference_type d) const { return {first, k, m - d}; }
+        friend inline iterator operator+(difference_type d, const iterator &it) { return it + d; }
+        inline difference_type operator-(const iterator &other) const { return m - other.m; }
+        inline bool operator==(const iterator &other) const { return m == other.m; }
+        inline bool operator!=(const iterator &other) const { return m != other.m; }
+        inline bool operator<(const iterator &other) const { return m < other.m; }
+        inline bool operator>(const iterator &other) const { return m > other.m; }
+        inline bool operator<=(const iterator &other) const { return m <= other.m; }
+        inline bool operator>=(const iterator &other) const { return m >= other.m; }
     };
-    iterator _begin, _end;
+
+    pairs_with_view() = default;
+    pairs_with_view(T &vec, std::size_t k) : first(vec.begin()), n(vec.size()), k(k) {
+        assert(k < n && "index out of range");
+    }
+    iterator begin() const { return {first, k, 0}; }
+    iterator end() const { return {first, k, static_cast<std::ptrdiff_t>(size())}; }
+    std::size_t size() const { return n - (n > 0); }
+};
+
+/** Pairs of element `k` with all other elements of `v`; see `pairs_with_view` */
+template <class T> pairs_with_view<T> pairs_with(T &v, std::size_t k) { return pairs_with_view<T>(v, k); }
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE("pairs_with") {
+    std::vector<int> v = {10, 11, 12, 13, 14};
+    std::vector<std::pair<int, int>> found;
+    for (auto [a, b] : pairs_with(v, 2))
+        found.emplace_back(a, b);
+    CHECK(found == std::vector<std::pair<int, int>>{{12, 10}, {12, 11}, {12, 13}, {12, 14}});
+    auto pairs = pairs_with(v, 0);
+    CHECK(pairs.size() == 4);
+    CHECK(pairs.end() - pairs.begin() == 4);
+    CHECK((pairs.begin() + 3).indices() == std::pair<std::size_t, std::size_t>(0, 4));
+    CHECK(std::get<1>(pairs.begin()[0]) == 11);
+    std::get<1>(*--pairs_with(v, 4).end()) = -1; // mutable references
+    CHECK(v[3] == -1);
+    const auto &cv = v;
+    CHECK(std::is_same<decltype(std::get<0>(*pairs_with(cv, 1).begin())), const int &>::value);
+    std::vector<int> one = {1};
+    CHECK(pairs_with(one, 0).begin() == pairs_with(one, 0).end());
+}
+#endif
+
+/**
+ * Binomial coefficient n choose k; exact as long as the result fits. Each step computes
+ * C(n, i+1) = C(n, i) (n-i) / (i+1) with the common factor of C(n, i) and i+1 divided out
+ * first, so no intermediate exceeds the result.
+ */
+constexpr std::size_t binomial(std::size_t n, std::size_t k) {
+    if (k > n)
+        return 0;
+    k = std::min(k, n - k);
+    std::size_t result = 1;
+    for (std::size_t i = 0; i < k; i++) {
+        const auto g = std::gcd(result, i + 1);
+        result = (result / g) * ((n - i) / ((i + 1) / g)); // (i+1)/g divides n-i
+    }
+    return result;
+}
+
+/**
+ * @brief Maps a linear index to the k'th combination of `K` ascending indices out of n
+ *
+ * Combinations are enumerated in lexicographic order, as `internal_pairs` does for `K=2`.
+ * Each index is found by bisection on the number of combinations that remain once it is
+ * fixed, which by the hockey-stick identity is a single binomial coefficient.
+ */
+template <std::size_t K> std::array<std::size_t, K> combination_unrank(std::size_t k, std::size_t n) {
+    std::array<std::size_t, K> index{};
+    std::size_t lo = 0; // smallest allowed value for the current index
+    for (std::size_t p = 0; p < K; p++) {
+        const std::size_t m = K - p; // indices left to place, including this one
+        const std::size_t total = binomial(n - lo, m);
+        // largest x with binomial(n - x, m) >= total - k, i.e. fewer than k+1 combinations skipped
+        std::size_t first = lo, last = n - m;
+        while (first < last) {
+            auto x = first + (last - first + 1) / 2;
+            if (binomial(n - x, m) >= total - k)
+                first = x;
+            else
+                last = x - 1;
+        }
+        k -= total - binomial(n - first, m);
+        index[p] = first;
+        lo = first + 1;
+    }
+    return index;
+}
+
+/**
+ * @brief Iterator view to all unique combinations of `K` elements in a container
+ *
+ * Generalizes `internal_pairs` to triplets and higher: dereferencing yields a `std::tuple`
+ * of `K` (const) references to elements with strictly ascending container indices, visited
+ * in lexicographic order. Nothing is materialized and `size()` is a binomial coefficient.
+ * For random access containers the iterator is random access using `combination_unrank()`,
+ * so the view can be split across threads with `parallel_for_pairs()`; otherwise it is a
+ * forward iterator. Create with `combinations<K>()`.
+ *
+ * Example:
+ *
+ * ~~~ cpp
+ * for (auto [i, j, k] : combinations<3>(v))
+ *     u += axilrod_teller(i, j, k);
+ * ~~~
+ */
+template <std::size_t K, class T, bool Const = std::is_const<T>::value> class combination_view {
+    static_assert(K > 0, "combinations need at least one element");
+    using iter = typename std::conditional<Const, typename T::const_iterator, typename T::iterator>::type;
+    using reference = typename std::conditional<Const, typename T::const_reference, typename T::reference>::type;
+    static constexpr bool random_access =
+        std::is_base_of<std::random_access_iterator_tag, typename std::iterator_traits<iter>::iterator_category>::value;
+
+    template <std::size_t> using repeat = reference;
+    template <std::size_t... I> static std::tuple<repeat<I>...> tuple_type(std::index_sequence<I...>);
+
+    T &vec;
 
   public:
-    cartesian_product(Iter1 first1, Iter1 last1, Iter2 first2, Iter2 last2)
-        : _begin(first1, last1, first2, last2), _end(last1, last1, last2, last2) {
-        if (size() == 0)
-            _begin = _end;
+    class iterator {
+      public:
+        using pointer = void;
+        using value_type = decltype(tuple_type(std::make_index_sequence<K>()));
+        using reference = value_type;
+        using difference_type = std::ptrdiff_t;
+        using iterator_category =
+            std::conditional_t<random_access, std::random_access_iterator_tag, std::forward_iterator_tag>;
+
+        iterator() = default;
+        iterator(iter first, std::size_t n, std::size_t k) : first(first), n(n) { seek(k); }
+
+        inline value_type operator*() const { return dereference(std::make_index_sequence<K>()); }
+        inline value_type operator[](difference_type d) const { return *(*this + d); }
+        /** Container indices of the current combination */
+        inline const std::array<std::size_t, K> &indices() const { return index; }
+
+        inline iterator &operator++() {
+            if (++k < binomial(n, K)) {
+                auto p = K - 1;
+                while (index[p] == n - K + p) // rightmost index that can still grow
+                    p--;
+                index[p]++;
+                if constexpr (not random_access)
+                    ++elements[p];
+                for (auto q = p + 1; q < K; q++) {
+                    index[q] = index[q - 1] + 1;
+                    if constexpr (not random_access)
+                        elements[q] = std::next(elements[q - 1]);
+                }
+            }
+            return *this;
+        }
+        inline iterator operator++(int) {
+            auto tmp = *this;
+            ++*this;
+            return tmp;
+        }
+        inline iterator &operator--() {
+            static_assert(random_access, "only random access combinations can move backwards");
+            if (k-- == binomial(n, K)) // from one past the last
+                seek(k);
+            else {
+                auto p = K - 1;
+                while (index[p] == (p == 0 ? 0 : index[p - 1] + 1)) // rightmost index that can shrink
+                    p--;
+                index[p]--;
+                for (auto q = p + 1; q < K; q++)
+                    index[q] = n - K + q;
+            }
+            return *this;
+        }
+        inline iterator operator--(int) {
+            auto tmp = *this;
+            --*this;
+            return tmp;
+        }
+        inline iterator &operator+=(difference_type d) {
+            seek(k + d);
+            return *this;
+        }
+        inline iterator &operator-=(difference_type d) { return *this += -d; }
+        inline iterator operator+(difference_type d) const { return iterator(*this) += d; }
+        inline iterator operator-(difference_type d) const { return iterator(*this) -= d; }
+        friend inline iterator operator+(difference_type d, const iterator &it) { return it + d; }
+        inline difference_type operator-(const iterator &other) const {
+            return static_cast<difference_type>(k) - static_cast<difference_type>(other.k);
+        }
+        inline bool operator==(const iterator &other) const { return k == other.k; }
+        inline bool operator!=(const iterator &other) const { return k != other.k; }
+        inline bool operator<(const iterator &other) const { return k < other.k; }
+        inline bool operator>(const iterator &other) const { return k > other.k; }
+        inline bool operator<=(const iterator &other) const { return k <= other.k; }
+        inline bool operator>=(const iterator &other) const { return k >= other.k; }
+
+      private:
+        iter first;
+        std::size_t n = 0, k = 0;           // container size; linear index
+        std::array<std::size_t, K> index{}; // ascending container indices
+        std::conditional_t<random_access, std::tuple<>, std::array<iter, K>> elements; // iterators to `index`
+
+        void seek(std::size_t k) {
+            this->k = k;
+            if (k >= binomial(n, K))
+                return; // one iteration after last combination
+            index = combination_unrank<K>(k, n);
+            if constexpr (not random_access)
+                for (std::size_t p = 0; p < K; p++)
+                    elements[p] = std::next(p == 0 ? first : elements[p - 1], index[p] - (p == 0 ? 0 : index[p - 1]));
+        }
+        template <std::size_t... I> inline value_type dereference(std::index_sequence<I...>) const {
+            if constexpr (random_access)
+                return value_type(first[index[I]]...);
+            else
+                return value_type(*elements[I]...);
+        }
+    };
+
+    combination_view(T &vec) : vec(vec) {}
+
+    template <bool _Const = Const> std::enable_if_t<_Const, iterator> begin() const {
+        return iterator(vec.begin(), vec.size(), 0);
     }
-    auto begin() const { return _begin; }
-    auto end() const { return _end; }
-    size_t size() const {
-        return std::distance(_begin.pos1, _begin.last1) * std::distance(_begin.first2, _begin.last2);
+    template <bool _Const = Const> std::enable_if_t<_Const, iterator> end() const {
+        return iterator(vec.begin(), vec.size(), size());
+    }
+    template <bool _Const = Const> std::enable_if_t<not _Const, iterator> begin() {
+        return iterator(vec.begin(), vec.size(), 0);
+    }
+    template <bool _Const = Const> std::enable_if_t<not _Const, iterator> end() {
+        return iterator(vec.begin(), vec.size(), size());
     }
+
+    std::size_t size() const { return binomial(vec.size(), K); }
 };
 
+/** View to all unique combinations of `K` elements in `v`; see `combination_view` */
+template <std::size_t K, class T> combination_view<K, T> combinations(T &v) { return combination_view<K, T>(v); }
+
 #ifdef DOCTEST_LIBRARY_INCLUDED
-TEST_CASE_TEMPLATE("cartesian_product", T, std::vector<int>) {
-    T vec1 = {0, 1, 3};
-    T vec2 = {10, 20};
-    cartesian_product pairs(vec1.begin(), vec1.end(), vec2.begin(), vec2.end());
+TEST_CASE("combination_unrank") {
+    CHECK(binomial(6, 3) == 20);
+    CHECK(binomial(3, 5) == 0);
+    CHECK(binomial(100000, 3) == 166661666700000);
+    CHECK(binomial(110000, 4) == 6100083922212472500u); // naive n (n-1) (n-2) (n-3) / 4! overflows
+    CHECK(binomial(67, 33) == 14226520737620288370u);    // largest central coefficient below 2^64
+    static_assert(binomial(110000, 4) == 6100083922212472500u);
+    for (std::size_t n : {2, 3, 7, 10}) { // agrees with triangular_unrank for pairs
+        for (std::size_t k = 0; k < binomial(n, 2); k++) {
+            auto [i, j] = triangular_unrank(k, n);
+            CHECK(combination_unrank<2>(k, n) == std::array<std::size_t, 2>{i, j});
+        }
+    }
+    CHECK(combination_unrank<3>(0, 5) == std::array<std::size_t, 3>{0, 1, 2});
+    CHECK(combination_unrank<3>(9, 5) == std::array<std::size_t, 3>{2, 3, 4});
+    CHECK(combination_unrank<4>(binomial(1000, 4) - 1, 1000) == std::array<std::size_t, 4>{996, 997, 998, 999});
+    CHECK(combination_unrank<4>(binomial(110000, 4) - 1, 110000) ==
+          std::array<std::size_t, 4>{109996, 109997, 109998, 109999});
+    std::vector<char> large(110000);
+    CHECK(combinations<4>(large).size() == 6100083922212472500u);
+}
 
-    CHECK(pairs.size() == 6);
-    CHECK(std::distance(pairs.begin(), pairs.end()) == 6);
+TEST_CASE_TEMPLATE("combinations", T, std::vector<int>, std::list<int>) {
+    T vec(7);
+    std::iota(vec.begin(), vec.end(), 0);
+    auto triplets = combinations<3>(vec);
+    CHECK(triplets.size() == 35);
+    CHECK(std::distance(triplets.begin(), triplets.end()) == 35);
 
-    // sum second value from all pairs
-    CHECK(std::accumulate(pairs.begin(), pairs.end(), 0, [](int sum, auto pair) { return sum + std::get<1>(pair); }) ==
-          90);
+    std::vector<std::tuple<int, int, int>> expected; // nested loops
+    for (int i = 0; i < 7; i++)
+        for (int j = i + 1; j < 7; j++)
+            for (int k = j + 1; k < 7; k++)
+                expected.emplace_back(i, j, k);
+    std::vector<std::tuple<int, int, int>> found;
+    for (auto [i, j, k] : triplets)
+        found.emplace_back(i, j, k);
+    CHECK(found == expected);
 
-    auto it = pairs.begin();
-    CHECK(*it == std::tuple(0, 10));
-    it.operator++();
-    CHECK(*it == std::tuple(0, 20));
-    it.operator++();
-    CHECK(*it == std::tuple(1, 10));
-    it.operator++();
-    CHECK(*it == std::tuple(1, 20));
-    it.operator++();
-    CHECK(*it == std::tuple(3, 10));
-    it.operator++();
-    CHECK(*it == std::tuple(3, 20));
+    SUBCASE("random access and degenerate sizes") {
+        if constexpr (std::is_same<T, std::vector<int>>::value) {
+            auto it = triplets.begin();
+            for (std::size_t k = 0; k < expected.size(); k++)
+                CHECK(it[k] == expected[k]);
+            auto last = triplets.end();
+            for (auto k = expected.size(); k-- > 0;)
+                CHECK(*--last == expected[k]);
+            CHECK(last == triplets.begin());
+            CHECK((triplets.begin() + 20).indices() == std::array<std::size_t, 3>{1, 3, 5});
+        }
+        T small(2);
+        CHECK(combinations<3>(small).size() == 0);
+        CHECK(combinations<3>(small).begin() == combinations<3>(small).end());
+        CHECK(combinations<1>(small).size() == 2);
+    }
 
-    vec1.clear();
-    for (auto [i,j] : cartesian_product(vec1.begin(), vec1.end(), vec2.begin(), vec2.end())) {
-        CHECK(false);
+    std::get<2>(*triplets.begin()) = -1; // modify through references
+    CHECK(*std::next(vec.begin(), 2) == -1);
+    const T &cvec = vec;
+    CHECK(std::get<0>(*combinations<2>(cvec).begin()) == 0);
+}
+#endif
+
+/**
+ * @brief Unique pairs of N elements with the loop fully unrolled at compile time
+ *
+ * For small, fixed size groups such as the sites of a rigid molecule, the pair indices are
+ * generated as a `std::index_sequence` and the visitor is inlined once per pair, with no loop
+ * or iterator comparisons left, so that the compiler can keep all sites in registers. The visitor
+ * is called with the elements of a tuple-like container (`std::array`, `std::tuple`, ...) or,
+ * without a container, with the indices as `std::integral_constant`. Everything is `constexpr`.
+ *
+ * Example:
+ *
+ * ~~~ cpp
+ * std::array<Eigen::Vector3d, 4> sites;
+ * double u = 0;
+ * static_pairs<4>::for_each(sites, [&](const auto &a, const auto &b) { u += 1 / (a - b).norm(); });
+ * static_assert(static_pairs<4>::size == 6);
+ * ~~~
+ */
+template <std::size_t N> struct static_pairs {
+    static constexpr std::size_t size = N * (N - (N > 0)) / 2;
+
+    /** First and second index of each pair, in the order of `internal_pairs` */
+    static constexpr std::array<std::size_t, size> first = [] {
+        std::array<std::size_t, size> index{};
+        for (std::size_t i = 0, k = 0; i < N; i++)
+            for (std::size_t j = i + 1; j < N; j++)
+                index[k++] = i;
+        return index;
+    }();
+    static constexpr std::array<std::size_t, size> second = [] {
+        std::array<std::size_t, size> index{};
+        for (std::size_t i = 0, k = 0; i < N; i++)
+            for (std::size_t j = i + 1; j < N; j++)
+                index[k++] = j;
+        return index;
+    }();
+
+    /** Call `fn(i, j)` for all pairs with compile time indices */
+    template <class Function> static constexpr void for_each(Function &&fn) {
+        unroll(fn, std::make_index_sequence<size>());
+    }
+
+    /** Call `fn(std::get<i>(c), std::get<j>(c))` for all pairs; `c` has N elements */
+    template <class Container, class Function> static constexpr void for_each(Container &&c, Function &&fn) {
+        static_assert(std::tuple_size<std::decay_t<Container>>::value == N, "container must have N elements");
+        for_each([&](auto i, auto j) { fn(std::get<i>(c), std::get<j>(c)); });
+    }
+
+  private:
+    template <class Function, std::size_t... K>
+    static constexpr void unroll(Function &fn, std::index_sequence<K...>) {
+        (fn(std::integral_constant<std::size_t, first[K]>(), std::integral_constant<std::size_t, second[K]>()), ...);
     }
+};
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE("static_pairs") {
+    static_assert(static_pairs<0>::size == 0 and static_pairs<1>::size == 0 and static_pairs<8>::size == 28);
+    constexpr auto weighted_sum = [] {
+        std::array<int, 5> v = {1, 2, 3, 4, 5};
+        int sum = 0;
+        static_pairs<5>::for_each(v, [&](int a, int b) { sum += a * b; });
+        return sum;
+    }();
+    static_assert(weighted_sum == 85);
+
+    std::array<int, 4> v = {1, 2, 3, 4};
+    std::vector<std::pair<int, int>> expected, found;
+    for (auto [a, b] : internal_pairs(v))
+        expected.emplace_back(a, b);
+    static_pairs<4>::for_each(v, [&](int &a, int &b) { found.emplace_back(a, b); });
+    CHECK(found == expected);
+    static_pairs<4>::for_each(v, [](int &a, int &b) { a += b; }); // mutable references
+    CHECK(v == std::array<int, 4>{10, 9, 7, 4});
+
+    std::tuple<int, double, std::string> mixed = {2, 0.5, "x"}; // heterogeneous elements
+    std::size_t cnt = 0;
+    static_pairs<3>::for_each(mixed, [&](const auto &, const auto &) { cnt++; });
+    CHECK(cnt == 3);
+    static_pairs<1>::for_each([&](auto, auto) { cnt++; });
+    CHECK(cnt == 3);
+}
+#endif
+
+/**
+ * @brief View to the cartesian product of N ranges, created with `cartesian_product(a, b, c, ...)`
+ *
+ * Dereferencing yields a tuple of references, one element from each range, with the last
+ * range varying fastest; references are const for const containers. Range sizes are cached
+ * at construction so `size()` is O(1) also for lists.
+ * If all ranges are random access, so is the iterator: the linear index k is the mixed-radix number
+ * whose digits are the positions in each range. This lets e.g. `parallel_for_pairs()` split large
+ * parameter grids evenly across threads.
+ */
+template <class... Iters> class product_view : public view_base {
+    static constexpr std::size_t N = sizeof...(Iters);
+    template <class Iter>
+    static constexpr bool is_random_access =
+        std::is_base_of<std::random_access_iterator_tag, typename std::iterator_traits<Iter>::iterator_category>::value;
+    static constexpr bool random_access = (is_random_access<Iters> and ...);
+
+  public:
+    using value_type = std::tuple<typename std::iterator_traits<Iters>::reference...>;
+
+    class iterator {
+      public:
+        using iterator_category =
+            std::conditional_t<random_access, std::random_access_iterator_tag, std::forward_iterator_tag>;
+        using value_type = product_view::value_type;
+        using difference_type = std::ptrdiff_t;
+        using reference = value_type;
+        using pointer = void;
+
+        iterator() = default;
+        iterator(const std::tuple<Iters...> &first, const std::array<std::size_t, N> &sizes, std::size_t k)
+            : first(first), current(first), sizes(sizes) {
+            seek(k);
+        }
+
+        inline value_type operator*() const { return dereference(std::index_sequence_for<Iters...>()); }
+        inline value_type operator[](difference_type d) const { return *(*this + d); }
+        /** Position in each range */
+        inline const std::array<std::size_t, N> &indices() const { return digits; }
+
+        inline iterator &operator++() {
+            k++;
+            increment<N - 1>();
+            return *this;
+        }
+        inline iterator operator++(int) {
+            auto tmp = *this;
+            ++*this;
+            return tmp;
+        }
+        inline iterator &operator--() {
+            static_assert(random_access, "only random access products can move backwards");
+            k--;
+            decrement<N - 1>();
+            return *this;
+        }
+        inline iterator operator--(int) {
+            auto tmp = *this;
+            --*this;
+            return tmp;
+        }
+        inline iterator &operator+=(difference_type d) {
+            seek(k + d);
+            return *this;
+        }
+        inline iterator &operator-=(difference_type d) { return *this += -d; }
+        inline iterator operator+(difference_type d) const { return iterator(*this) += d; }
+        inline iterator operator-(difference_type d) const { return iterator(*this) -= d; }
+        friend inline iterator operator+(difference_type d, const iterator &it) { return it + d; }
+        inline difference_type operator-(const iterator &other) const {
+            return static_cast<difference_type>(k) - static_cast<difference_type>(other.k);
+        }
+        inline bool operator==(const iterator &other) const { return k == other.k; }
+        inline bool operator!=(const iterator &other) const { return k != other.k; }
+        inline bool operator<(const iterator &other) const { return k < other.k; }
+        inline bool operator>(const iterator &other) const { return k > other.k; }
+        inline bool operator<=(const iterator &other) const { return k <= other.k; }
+        inline bool operator>=(const iterator &other) const { return k >= other.k; }
+
+      private:
+        std::tuple<Iters...> first, current; // first and current element of each range
+        std::array<std::size_t, N> sizes{};  // range sizes
+        std::array<std::size_t, N> digits{}; // position in each range; all zero one past the last
+        std::size_t k = 0;                   // linear index
+
+        void seek(std::size_t k) {
+            this->k = k;
+            for (auto p = N; p-- > 0;) {
+                digits[p] = sizes[p] > 0 ? k % sizes[p] : 0;
+                k = sizes[p] > 0 ? k / sizes[p] : 0;
+            }
+            if constexpr (not random_access)
+                current = advance_all(std::index_sequence_for<Iters...>());
+        }
+        template <std::size_t... I> std::tuple<Iters...> advance_all(std::index_sequence<I...>) const {
+            return {std::next(std::get<I>(first), digits[I])...};
+        }
+        template <std::size_t P> void increment() {
+            if (++digits[P] < sizes[P]) {
+                if constexpr (not random_access)
+                    ++std::get<P>(current);
+                return;
+            }
+            digits[P] = 0; // carry to the previous range
+            if constexpr (not random_access)
+                std::get<P>(current) = std::get<P>(first);
+            if constexpr (P > 0)
+                increment<P - 1>();
+        }
+        template <std::size_t P> void decrement() {
+            if (digits[P]-- > 0)
+                return;
+            digits[P] = sizes[P] - 1; // borrow from the previous range
+            if constexpr (P > 0)
+                decrement<P - 1>();
+        }
+        template <std::size_t... I> inline value_type dereference(std::index_sequence<I...>) const {
+            if constexpr (random_access)
+                return value_type(std::get<I>(first)[digits[I]]...);
+            else
+                return value_type(*std::get<I>(current)...);
+        }
+    };
+
+    template <class... Containers>
+    explicit product_view(Containers &...ranges)
+        : first(ranges.begin()...), sizes{static_cast<std::size_t>(std::size(ranges))...} {
+        static_assert(sizeof...(Containers) == N, "one container per range");
+    }
+
+    iterator begin() const { return iterator(first, sizes, 0); }
+    iterator end() const { return iterator(first, sizes, size()); }
+    std::size_t size() const {
+        std::size_t n = 1;
+        for (auto size : sizes)
+            n *= size;
+        return n;
+    }
+
+  private:
+    std::tuple<Iters...> first;
+    std::array<std::size_t, N> sizes;
+};
+
+/**
+ * View to pairs in two containers
+ *
+ * Dereferencing yields a tuple of references through the given iterators, i.e. const
+ * references for `const_iterator` or const containers and mutable references otherwise.
+ * Calling `std::distance` is of O(N) complexity while `size` has constant complexity
+ * as the range sizes are found once at construction
+ *
+ * If both iterators are random access, so is the view's iterator whereby
+ * the linear pair index k maps to (k / n2, k % n2).
+ *
+ * Passing `tile<B>` visits the product block by block of B x B pairs
+ * (see `internal_pairs`) and requires random access iterators.
+ *
+ * Containers can be given directly, `cartesian_product(a, b)`, and three or more containers
+ * give the N-dimensional `product_view`, `cartesian_product(a, b, c)`.
+ */
+template <class Iter1, class Iter2, std::size_t Tile = 0, class... More> class cartesian_product : public view_base {
+  private:
+    using value_type =
+        std::tuple<typename std::iterator_traits<Iter1>::reference, typename std::iterator_traits<Iter2>::reference>;
+
+    struct forward_iterator {
+        // these five are useful for stl
+        using iterator_category = std::forward_iterator_tag; // we can only move forward
+        using value_type = cartesian_product::value_type;
+        using difference_type = std::ptrdiff_t;
+        using reference = value_type;
+        using pointer = void;
+
+        Iter1 pos1, last1;
+        Iter2 pos2, first2, last2;
+        forward_iterator() = default;
+        forward_iterator(Iter1 first1, Iter1 last1, Iter2 first2, Iter2 last2)
+            : pos1(first1), last1(last1), pos2(first2), first2(first2), last2(last2) {}
+
+        inline value_type operator*() const { return {*pos1, *pos2}; }
+        inline bool operator==(const forward_iterator &other) const {
+            return (pos1 == other.pos1) and (pos2 == other.pos2);
+        }
+        inline bool operator!=(const forward_iterator &other) const { return not(*this == other); }
+        inline forward_iterator &operator++() {
+            if (++pos2 == last2) {
+                pos2 = first2;
+                pos1++;
+                if (pos1 == last1)
+                    pos2 = last2;
+            }
+            return *this;
+        }
+        inline forward_iterator operator++(int) {
+            auto tmp = *this;
+            ++*this;
+            return tmp;
+        }
+        size_t size() const { return std::distance(pos1, last1) * std::distance(first2, last2); }
+    };
+
+    struct random_access_iterator {
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = cartesian_product::value_type;
+        using difference_type = std::ptrdiff_t;
+        using reference = value_type;
+        using pointer = void;
+
+        Iter1 first1;
+        Iter2 first2;
+        difference_type n1 = 0, n2 = 0, k = 0, a = 0, b = 0; // range sizes; linear index; position in ranges
+
+        random_access_iterator() = default;
+        random_access_iterator(Iter1 first1, Iter1 last1, Iter2 first2, Iter2 last2)
+            : first1(first1), first2(first2), n1(last1 - first1), n2(last2 - first2) {}
+
+        inline void seek(difference_type k) {
+            this->k = k;
+            a = n2 > 0 ? k / n2 : 0;
+            b = n2 > 0 ? k % n2 : 0;
+        }
+        inline value_type operator*() const { return {first1[a], first2[b]}; }
+        inline value_type operator[](difference_type d) const { return *(*this + d); }
+        inline random_access_iterator &operator++() {
+            k++;
+            if (++b == n2) {
+                b = 0;
+                a++;
+            }
+            return *this;
+        }
+        inline random_access_iterator &operator--() {
+            k--;
+            if (b-- == 0) {
+                b = n2 - 1;
+                a--;
+            }
+            return *this;
+        }
+        inline random_access_iterator operator++(int) {
+            auto tmp = *this;
+            ++*this;
+            return tmp;
+        }
+        inline random_access_iterator operator--(int) {
+            auto tmp = *this;
+            --*this;
+            return tmp;
+        }
+        inline random_access_iterator &operator+=(difference_type d) {
+            seek(k + d);
+            return *this;
+        }
+        inline random_access_iterator &operator-=(difference_type d) { return *this += -d; }
+        inline random_access_iterator operator+(difference_type d) const { return random_access_iterator(*this) += d; }
+        inline random_access_iterator operator-(difference_type d) const { return random_access_iterator(*this) -= d; }
+        friend inline random_access_iterator operator+(difference_type d, const random_access_iterator &it) {
+            return it + d;
+        }
+        inline difference_type operator-(const random_access_iterator &other) const { return k - other.k; }
+        inline bool operator==(const random_access_iterator &other) const { return k == other.k; }
+        inline bool operator!=(const random_access_iterator &other) const { return k != other.k; }
+        inline bool operator<(const random_access_iterator &other) const { return k < other.k; }
+        inline bool operator>(const random_access_iterator &other) const { return k > other.k; }
+        inline bool operator<=(const random_access_iterator &other) const { return k <= other.k; }
+        inline bool operator>=(const random_access_iterator &other) const { return k >= other.k; }
+        size_t size() const { return n1 * n2; }
+        void seek_end() { seek(n1 * n2); }
+    };
+
+    struct tiled_iterator {
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = cartesian_product::value_type;
+        using difference_type = std::ptrdiff_t;
+        using reference = value_type;
+        using pointer = void;
+
+        Iter1 first1;
+        Iter2 first2;
+        difference_type n1 = 0, n2 = 0, a = 0, b = 0; // range sizes; position in ranges
+        difference_type ba = 0, bb = 0;               // first index of the current tiles
+        difference_type a_end = 0, b_end = 0;         // one past last index of the current tiles
+
+        tiled_iterator() = default;
+        tiled_iterator(Iter1 first1, Iter1 last1, Iter2 first2, Iter2 last2)
+            : first1(first1), first2(first2), n1(last1 - first1), n2(last2 - first2), a(0), b(0), ba(0), bb(0),
+              a_end(std::min<difference_type>(Tile, n1)), b_end(std::min<difference_type>(Tile, n2)) {
+            if (size() == 0)
+                seek_end();
+        }
+        inline value_type operator*() const { return {first1[a], first2[b]}; }
+        inline bool operator==(const tiled_iterator &other) const { return (a == other.a) and (b == other.b); }
+        inline bool operator!=(const tiled_iterator &other) const { return not(*this == other); }
+        inline tiled_iterator &operator++() {
+            if (++b < b_end)
+                return *this;
+            if (++a < a_end) {
+                b = bb;
+                return *this;
+            }
+            bb += Tile; // move to next tile
+            if (bb >= n2) {
+                bb = 0;
+                ba += Tile;
+            }
+            if (ba >= n1)
+                seek_end();
+            else {
+                a = ba;
+                b = bb;
+                a_end = std::min<difference_type>(ba + Tile, n1);
+                b_end = std::min<difference_type>(bb + Tile, n2);
+            }
+            return *this;
+        }
+        inline tiled_iterator operator++(int) {
+            auto tmp = *this;
+            ++*this;
+            return tmp;
+        }
+        size_t size() const { return n1 * n2; }
+        void seek_end() {
+            a = ba = n1;
+            b = bb = n2;
+        }
+    };
+
+    template <class Iter>
+    static constexpr bool is_random_access =
+        std::is_base_of<std::random_access_iterator_tag, typename std::iterator_traits<Iter>::iterator_category>::value;
+
+  public:
+    static_assert(Tile == 0 or (is_random_access<Iter1> and is_random_access<Iter2>),
+                  "tiled traversal requires random access iterators");
+
+  public:
+    using iterator = typename std::conditional<
+        Tile != 0, tiled_iterator,
+        typename std::conditional<is_random_access<Iter1> and is_random_access<Iter2>, random_access_iterator,
+                                  forward_iterator>::type>::type;
+
+  private:
+    iterator _begin, _end;
+    size_t _size = 0; // number of pairs
+
+  public:
+    cartesian_product(Iter1 first1, Iter1 last1, Iter2 first2, Iter2 last2)
+        : _begin(first1, last1, first2, last2), _end(last1, last1, last2, last2), _size(_begin.size()) {
+        if constexpr (std::is_same<iterator, forward_iterator>::value) {
+            if (size() == 0)
+                _begin = _end;
+        } else {
+            _end = _begin;
+            _end.seek_end();
+        }
+    }
+    cartesian_product(Iter1 first1, Iter1 last1, Iter2 first2, Iter2 last2, tile_t<Tile>)
+        : cartesian_product(first1, last1, first2, last2) {}
+    template <class Container1, class Container2>
+    cartesian_product(Container1 &c1, Container2 &c2) : cartesian_product(c1.begin(), c1.end(), c2.begin(), c2.end()) {}
+    cartesian_product() = default;
+    auto begin() const { return _begin; }
+    auto end() const { return _end; }
+    size_t size() const { return _size; }
+};
+
+/** Product of three or more ranges */
+template <class Iter1, class Iter2, std::size_t Tile, class Iter3, class... Iters>
+class cartesian_product<Iter1, Iter2, Tile, Iter3, Iters...> : public product_view<Iter1, Iter2, Iter3, Iters...> {
+    static_assert(Tile == 0, "tiled traversal is only available for two ranges");
+
+  public:
+    using product_view<Iter1, Iter2, Iter3, Iters...>::product_view;
+};
+
+template <class Container1, class Container2>
+cartesian_product(Container1 &, Container2 &)
+    -> cartesian_product<container_iterator<Container1>, container_iterator<Container2>>;
+
+template <class Container1, class Container2, class Container3, class... Containers>
+cartesian_product(Container1 &, Container2 &, Container3 &, Containers &...)
+    -> cartesian_product<container_iterator<Container1>, container_iterator<Container2>, 0,
+                         container_iterator<Container3>, container_iterator<Containers>...>;
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE_TEMPLATE("cartesian_product", T, std::vector<int>) {
+    T vec1 = {0, 1, 3};
+    T vec2 = {10, 20};
+    cartesian_product pairs(vec1.begin(), vec1.end(), vec2.begin(), vec2.end());
+
+    CHECK(pairs.size() == 6);
+    CHECK(std::distance(pairs.begin(), pairs.end()) == 6);
+
+    // sum second value from all pairs
+    CHECK(std::accumulate(pairs.begin(), pairs.end(), 0, [](int sum, auto pair) { return sum + std::get<1>(pair); }) ==
+          90);
+
+    auto it = pairs.begin();
+    CHECK(*it == std::tuple(0, 10));
+    it.operator++();
+    CHECK(*it == std::tuple(0, 20));
+    it.operator++();
+    CHECK(*it == std::tuple(1, 10));
+    it.operator++();
+    CHECK(*it == std::tuple(1, 20));
+    it.operator++();
+    CHECK(*it == std::tuple(3, 10));
+    it.operator++();
+    CHECK(*it == std::tuple(3, 20));
+
+    vec1.clear();
+    for (auto [i,j] : cartesian_product(vec1.begin(), vec1.end(), vec2.begin(), vec2.end())) {
+        CHECK(false);
+    }
+}
+#endif
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE("cartesian_product_n") {
+    std::vector<int> a = {0, 1, 2};
+    std::list<int> b = {10, 20};
+    std::array<int, 4> c = {100, 200, 300, 400};
+
+    std::vector<std::tuple<int, int, int>> expected; // nested loops
+    for (auto i : a)
+        for (auto j : b)
+            for (auto k : c)
+                expected.emplace_back(i, j, k);
+
+    auto check = [&](auto grid) {
+        CHECK(grid.size() == expected.size());
+        std::vector<std::tuple<int, int, int>> found;
+        for (auto [i, j, k] : grid)
+            found.emplace_back(i, j, k);
+        CHECK(found == expected);
+    };
+    check(cartesian_product(a, b, c)); // forward, as `b` is a list
+    std::vector<int> b2(b.begin(), b.end());
+    auto grid = cartesian_product(a, b2, c);
+    check(grid);
+
+    // random access with mixed-radix unranking
+    auto it = grid.begin();
+    for (std::size_t k = 0; k < expected.size(); k++)
+        CHECK(it[k] == expected[k]);
+    CHECK((it + 13).indices() == std::array<std::size_t, 3>{1, 1, 1});
+    auto last = grid.end();
+    CHECK(*--last == expected.back());
+    CHECK(grid.end() - grid.begin() == 24);
+
+    std::vector<int> empty;
+    CHECK(cartesian_product(a, empty, c).size() == 0);
+    CHECK(cartesian_product(a, empty, c).begin() == cartesian_product(a, empty, c).end());
+
+    // two containers use the pair view; sizes of lists are cached
+    auto pairs = cartesian_product(a, b);
+    CHECK(pairs.size() == 6);
+    CHECK(std::distance(pairs.begin(), pairs.end()) == 6);
+}
+
+TEST_CASE("cartesian_product_mutable") {
+    std::vector<double> forces1(3, 0.0), forces2(2, 0.0);
+    for (auto [f1, f2] : cartesian_product(forces1, forces2)) { // update both sides in place
+        f1 += 1;
+        f2 -= 1;
+    }
+    CHECK(forces1 == std::vector<double>{2, 2, 2});
+    CHECK(forces2 == std::vector<double>{-3, -3});
+
+    std::list<int> a = {1, 2};
+    std::vector<int> b = {10}, c = {100, 200};
+    for (auto [i, j, k] : cartesian_product(a, b, c))
+        k += i + j;
+    CHECK(c == std::vector<int>{123, 223});
+
+    const auto &const_a = a; // const containers give const references
+    static_assert(
+        std::is_same<decltype(*cartesian_product(const_a, b).begin()), std::tuple<const int &, int &>>::value);
+    static_assert(std::is_same<decltype(*cartesian_product(b.cbegin(), b.cend(), c.begin(), c.end()).begin()),
+                               std::tuple<const int &, int &>>::value);
+
+#ifdef __cpp_lib_ranges
+    SUBCASE("std::ranges") {
+        auto pairs = cartesian_product(a, c);
+        static_assert(std::ranges::view<decltype(pairs)>);
+        static_assert(std::ranges::forward_range<decltype(pairs)>);
+        static_assert(std::ranges::random_access_range<decltype(cartesian_product(b, c))>);
+        static_assert(std::ranges::view<decltype(cartesian_product(a, b, c))>);
+        int sum = 0;
+        for (auto [i, k] : pairs | std::views::filter([](auto pair) { return std::get<0>(pair) == 2; })) {
+            k = 0; // modify through the filtered view
+            sum += i;
+        }
+        CHECK(sum == 4);
+        CHECK(c == std::vector<int>{0, 0});
+    }
+#endif
+}
+
+TEST_CASE("cartesian_product_tiled") {
+    std::vector<int> vec1 = {0, 1, 2}, vec2 = {10, 20, 30};
+    std::vector<std::tuple<int, int>> visited;
+    for (auto pair : cartesian_product(vec1.begin(), vec1.end(), vec2.begin(), vec2.end(), tile<2>))
+        visited.push_back(pair);
+    CHECK(visited == std::vector<std::tuple<int, int>>{
+                         {0, 10}, {0, 20}, {1, 10}, {1, 20}, {0, 30}, {1, 30}, {2, 10}, {2, 20}, {2, 30}});
+
+    for (int n1 = 0; n1 < 9; n1++)
+        for (int n2 = 0; n2 < 9; n2++) {
+            std::vector<int> v1(n1), v2(n2);
+            std::iota(v1.begin(), v1.end(), 0);
+            std::iota(v2.begin(), v2.end(), 100);
+            cartesian_product pairs(v1.begin(), v1.end(), v2.begin(), v2.end(), tile<3>);
+            std::vector<std::tuple<int, int>> tiled(pairs.begin(), pairs.end()), untiled;
+            for (auto pair : cartesian_product(v1.begin(), v1.end(), v2.begin(), v2.end()))
+                untiled.push_back(pair);
+            CHECK(tiled.size() == pairs.size());
+            std::sort(tiled.begin(), tiled.end());
+            CHECK(tiled == untiled);
+        }
+}
+#endif
+/**
+ * @brief Iterator view to unique pairs within a spherical cutoff in a periodic box
+ *
+ * Builds a cell list with cells no smaller than the cutoff so that only pairs in the
+ * same or in neighboring cells are considered, and yields only those pairs with a
+ * minimum image distance smaller than the cutoff. For a fixed density this makes the
+ * loop O(N) rather than O(N^2). As for `internal_pairs`, dereferencing yields a tuple
+ * of (const) references to the two elements.
+ *
+ * The positions are read through a pointer to a data member that, like the box side
+ * lengths, supports `operator[]` for each of the three dimensions, e.g. `Eigen::Vector3d`
+ * or `std::array<double, 3>`. The container must be random access. The cell list
+ * reflects the positions at construction; call `update()` after moving particles.
+ * The cutoff and the box lengths must be positive, or `std::invalid_argument` is thrown.
+ * Cells are enlarged where needed to keep their number below `max(65536, 2 N)`, since more
+ * cells than particles only cost memory.
+ *
+ * Example:
+ *
+ * ~~~ cpp
+ * struct Particle {
+ *     Eigen::Vector3d pos;
+ *     double charge;
+ * };
+ * std::vector<Particle> v;
+ * Eigen::Vector3d box = {10, 10, 10};
+ * for (auto [i,j] : cutoff_pairs(v, &Particle::pos, box, 2.5))
+ *     ...
+ * ~~~
+ */
+template <class T, class Member, class Box, bool Const = std::is_const<T>::value> class cutoff_pairs {
+  private:
+    using iter = typename std::conditional<Const, typename T::const_iterator, typename T::iterator>::type;
+    using reference = typename std::conditional<Const, typename T::const_reference, typename T::reference>::type;
+    static_assert(std::is_base_of<std::random_access_iterator_tag,
+                                  typename std::iterator_traits<iter>::iterator_category>::value,
+                  "cutoff_pairs requires a random access container");
+
+    T &vec;
+    Member member; // pointer to position data member
+    Box box;       // periodic box side lengths
+    double cutoff_squared;
+    std::array<std::size_t, 3> cells;                  // number of cells in each dimension
+    std::vector<std::size_t> cell_start, cell_members; // particles in cell c: [cell_start[c], cell_start[c+1])
+    std::vector<std::size_t> stencil_start, stencil;   // neighbor cells c2>=c of cell c, including c itself
+
+    std::size_t cell_index(std::size_t particle) const {
+        const auto &pos = vec[particle].*member;
+        std::size_t c = 0;
+        for (std::size_t d = 0; d < 3; d++) {
+            auto n = static_cast<std::ptrdiff_t>(cells[d]);
+            auto i = static_cast<std::ptrdiff_t>(std::floor(pos[d] / box[d] * n)) % n;
+            c = c * cells[d] + static_cast<std::size_t>(i < 0 ? i + n : i); // wrap into the box
+        }
+        return c;
+    }
+
+  public:
+    struct iterator {
+        using iterator_category = std::forward_iterator_tag;
+        using reference = cutoff_pairs::reference;
+        using value_type = std::tuple<reference, reference>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+
+        const cutoff_pairs *view;
+        iter first;
+        std::size_t c = 0, s = 0, s_end = 0; // current cell; neighbor cell slot in stencil
+        std::size_t p = 0, p_end = 0;        // first particle slot in cell_members
+        std::size_t q = 0, q_end = 0;        // second particle slot in cell_members
+        std::size_t c_end = 0;               // iteration stops before this cell
+
+        iterator(const cutoff_pairs *view, iter first, bool at_end)
+            : iterator(view, first, at_end ? view->cell_count() : 0, view->cell_count()) {}
+        /**
+         * First pair whose first particle is in [cell, cell_end); equal to `iterator(view, first,
+         * cell_end, cell_end)` if there is none. The end position is found without scanning later cells.
+         */
+        iterator(const cutoff_pairs *view, iter first, std::size_t cell, std::size_t cell_end)
+            : view(view), first(first), c(cell), c_end(cell_end) {
+            if (c >= c_end or view->vec.size() < 2)
+                c = c_end;
+            else {
+                start_cell();
+                settle();
+            }
+        }
+        inline value_type operator*() const { return {first[view->cell_members[p]], first[view->cell_members[q]]}; }
+        /** Container indices of the current pair */
+        inline std::pair<std::size_t, std::size_t> indices() const {
+            return {view->cell_members[p], view->cell_members[q]};
+        }
+        inline bool operator==(const iterator &other) const {
+            return c == other.c and s == other.s and p == other.p and q == other.q;
+        }
+        inline bool operator!=(const iterator &other) const { return not(*this == other); }
+        inline iterator &operator++() {
+            ++q;
+            settle();
+            return *this;
+        }
+
+      private:
+        void start_cell() {
+            s = view->stencil_start[c];
+            s_end = view->stencil_start[c + 1];
+            start_neighbor();
+        }
+        void start_neighbor() {
+            p = view->cell_start[c];
+            p_end = view->cell_start[c + 1];
+            q_end = view->cell_start[view->stencil[s] + 1];
+            start_particle();
+        }
+        void start_particle() {
+            if (p == p_end)
+                q = q_end;
+            else
+                q = (view->stencil[s] == c) ? p + 1 : view->cell_start[view->stencil[s]];
+        }
+        /** Move forward to the first pair inside the cutoff, starting from the current one */
+        void settle() {
+            while (true) {
+                if (q < q_end) {
+                    if (view->inside(view->cell_members[p], view->cell_members[q]))
+                        return;
+                    ++q;
+                } else if (p + 1 < p_end) {
+                    ++p;
+                    start_particle();
+                } else if (++s < s_end)
+                    start_neighbor();
+                else if (++c < c_end)
+                    start_cell();
+                else {
+                    s = p = q = 0; // one iteration after last pair
+                    return;
+                }
+            }
+        }
+    };
+
+    cutoff_pairs(T &vec, Member member, const Box &box, double cutoff)
+        : vec(vec), member(member), box(box), cutoff_squared(cutoff * cutoff) {
+        if (not(cutoff > 0))
+            throw std::invalid_argument("cutoff_pairs: cutoff must be positive");
+        const double limit = std::max(65536.0, 2.0 * vec.size()); // number of cells
+        std::array<double, 3> n;
+        for (std::size_t d = 0; d < 3; d++) {
+            if (not(box[d] > 0 and std::isfinite(box[d])))
+                throw std::invalid_argument("cutoff_pairs: box lengths must be positive and finite");
+            n[d] = std::clamp(std::floor(box[d] / cutoff), 1.0, limit);
+        }
+        while (n[0] * n[1] * n[2] > limit) { // shrink evenly; dimensions stuck at one leave more to the others
+            const double scale = std::cbrt(limit / (n[0] * n[1] * n[2]));
+            for (auto &cells_d : n)
+                cells_d = std::max(1.0, std::floor(cells_d * scale));
+        }
+        for (std::size_t d = 0; d < 3; d++)
+            cells[d] = static_cast<std::size_t>(n[d]);
+        const auto ncells = cells[0] * cells[1] * cells[2];
+
+        // neighbor cells, half of the 27-cell stencil; small boxes give duplicates that are removed
+        stencil_start.assign(1, 0);
+        stencil.clear();
+        for (std::size_t c = 0; c < ncells; c++) {
+            std::array<std::size_t, 3> cell = {c / (cells[1] * cells[2]), c / cells[2] % cells[1], c % cells[2]};
+            auto first = stencil.size();
+            for (int dx = -1; dx <= 1; dx++)
+                for (int dy = -1; dy <= 1; dy++)
+                    for (int dz = -1; dz <= 1; dz++) {
+                        std::array<int, 3> offset = {dx, dy, dz};
+                        std::size_t c2 = 0;
+                        for (std::size_t d = 0; d < 3; d++)
+                            c2 = c2 * cells[d] + (cell[d] + cells[d] + offset[d]) % cells[d];
+                        if (c2 >= c)
+                            stencil.push_back(c2);
+                    }
+            std::sort(stencil.begin() + first, stencil.end());
+            stencil.erase(std::unique(stencil.begin() + first, stencil.end()), stencil.end());
+            stencil_start.push_back(stencil.size());
+        }
+        update();
+    }
+
+    /** Reassign particles to cells after positions have changed */
+    void update() {
+        const auto ncells = stencil_start.size() - 1;
+        std::vector<std::size_t> cell_of(vec.size());
+        cell_start.assign(ncells + 1, 0);
+        for (std::size_t i = 0; i < vec.size(); i++) {
+            cell_of[i] = cell_index(i);
+            cell_start[cell_of[i] + 1]++;
+        }
+        std::partial_sum(cell_start.begin(), cell_start.end(), cell_start.begin());
+        cell_members.resize(vec.size());
+        auto fill = cell_start;
+        for (std::size_t i = 0; i < vec.size(); i++)
+            cell_members[fill[cell_of[i]]++] = i;
+    }
+
+    /** True if the minimum image distance between two particles is smaller than the cutoff */
+    bool inside(std::size_t i, std::size_t j) const {
+        const auto &a = vec[i].*member;
+        const auto &b = vec[j].*member;
+        double r2 = 0;
+        for (std::size_t d = 0; d < 3; d++) {
+            double dx = a[d] - b[d];
+            dx -= box[d] * std::round(dx / box[d]);
+            r2 += dx * dx;
+        }
+        return r2 < cutoff_squared;
+    }
+
+    iterator begin() const { return iterator(this, vec.begin(), false); } // first pair
+    iterator end() const { return iterator(this, vec.begin(), true); }    // one iteration after last pair
+
+    /** Number of cells; see `cell_pairs()` */
+    std::size_t cell_count() const { return cell_start.size() - 1; }
+
+    /** Range of the pairs visited from cell `c`; the ranges of all cells partition the pairs */
+    struct cell_range {
+        iterator first, last;
+        iterator begin() const { return first; }
+        iterator end() const { return last; }
+    };
+    cell_range cell_pairs(std::size_t c) const {
+        return {iterator(this, vec.begin(), c, c + 1), iterator(this, vec.begin(), c + 1, c + 1)};
+    }
+
+    /** Number of pairs tested against the cutoff from cell `c`, i.e. visited or skipped */
+    std::size_t candidate_pairs(std::size_t c) const {
+        const auto n = cell_start[c + 1] - cell_start[c];
+        std::size_t count = 0;
+        for (auto s = stencil_start[c]; s < stencil_start[c + 1]; s++) {
+            const auto c2 = stencil[s];
+            count += c2 == c ? n * (n - (n > 0)) / 2 : n * (cell_start[c2 + 1] - cell_start[c2]);
+        }
+        return count;
+    }
+};
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE("cutoff_pairs") {
+    struct Particle {
+        std::array<double, 3> pos;
+        double charge = 0;
+    };
+    std::mt19937 engine;
+    std::uniform_real_distribution<double> random(0.0, 1.0);
+
+    // compare with brute force minimum image search over all pairs
+    auto check = [&](std::array<double, 3> box, double cutoff, std::size_t n) {
+        std::vector<Particle> v(n);
+        for (auto &p : v)
+            for (std::size_t d = 0; d < 3; d++)
+                p.pos[d] = (random(engine) - 0.5) * 2 * box[d]; // also outside the box
+        std::set<std::pair<std::size_t, std::size_t>> expected, found;
+        for (std::size_t i = 0; i < n; i++)
+            for (std::size_t j = i + 1; j < n; j++) {
+                double r2 = 0;
+                for (std::size_t d = 0; d < 3; d++) {
+                    double dx = v[i].pos[d] - v[j].pos[d];
+                    dx -= box[d] * std::round(dx / box[d]);
+                    r2 += dx * dx;
+                }
+                if (r2 < cutoff * cutoff)
+                    expected.emplace(i, j);
+            }
+        std::size_t visited = 0;
+        for (auto [a, b] : cutoff_pairs(v, &Particle::pos, box, cutoff)) {
+            auto i = std::size_t(&a - v.data()), j = std::size_t(&b - v.data());
+            found.emplace(std::min(i, j), std::max(i, j));
+            visited++;
+        }
+        CHECK(visited == found.size()); // no duplicates
+        CHECK(found == expected);
+
+        cutoff_pairs pairs(v, &Particle::pos, box, cutoff);
+        std::size_t in_cells = 0;
+        for (std::size_t c = 0; c < pairs.cell_count(); c++)
+            in_cells += std::distance(pairs.cell_pairs(c).begin(), pairs.cell_pairs(c).end());
+        CHECK(in_cells == visited); // cells partition the pairs
+    };
+    check({10, 10, 10}, 2.0, 400);
+    check({10, 4, 20}, 1.5, 400); // uneven number of cells
+    check({2, 3, 10}, 1.0, 100);  // only one or two cells in some dimensions
+    check({1, 1, 1}, 2.0, 20);    // cutoff larger than box
+    check({10, 10, 10}, 2.0, 1);
+    check({10, 10, 10}, 2.0, 0);
+
+    // clustered particles in a mostly empty box; cell ranges must not scan the empty cells behind them
+    std::vector<Particle> cluster(400);
+    for (auto &p : cluster)
+        for (std::size_t d = 0; d < 3; d++)
+            p.pos[d] = 10 * random(engine);
+    cutoff_pairs sparse(cluster, &Particle::pos, std::array<double, 3>{100, 100, 100}, 2.5); // 64000 cells
+    std::size_t in_cells = 0, empty_ranges = 0;
+    for (std::size_t c = 0; c < sparse.cell_count(); c++) {
+        auto range = sparse.cell_pairs(c);
+        empty_ranges += range.begin() == range.end();
+        in_cells += std::distance(range.begin(), range.end());
+    }
+    CHECK(in_cells == std::size_t(std::distance(sparse.begin(), sparse.end())));
+    CHECK(empty_ranges > 60000);
+
+    // invalid cutoffs and boxes are rejected; tiny cutoffs give a bounded number of cells
+    const std::array<double, 3> cube = {10, 10, 10};
+    CHECK_THROWS_AS(cutoff_pairs(cluster, &Particle::pos, cube, 0.0), std::invalid_argument);
+    CHECK_THROWS_AS(cutoff_pairs(cluster, &Particle::pos, cube, -1.0), std::invalid_argument);
+    CHECK_THROWS_AS(cutoff_pairs(cluster, &Particle::pos, cube, std::nan("")), std::invalid_argument);
+    CHECK_THROWS_AS(cutoff_pairs(cluster, &Particle::pos, (std::array<double, 3>{10, 0, 10}), 1.0),
+                    std::invalid_argument);
+    cutoff_pairs tiny(cluster, &Particle::pos, cube, 1e-300);
+    CHECK(tiny.cell_count() <= 65536);
+    CHECK(tiny.cell_count() > 30000);
+    CHECK(std::distance(tiny.begin(), tiny.end()) == 0);
+    cutoff_pairs slab(cluster, &Particle::pos, std::array<double, 3>{1e6, 1e6, 1}, 1.0); // one cell thick
+    CHECK(slab.cell_count() <= 65536);
+    CHECK(slab.cell_count() > 30000);
+
+    // modify through references and update the cell list
+    std::vector<Particle> v(3);
+    v[0].pos = {0.5, 0.5, 0.5};
+    v[1].pos = {1.0, 0.5, 0.5};
+    v[2].pos = {9.8, 0.5, 0.5}; // close to v[0] through the periodic boundary
+    cutoff_pairs pairs(v, &Particle::pos, std::array<double, 3>{10, 10, 10}, 1.0);
+    CHECK(std::distance(pairs.begin(), pairs.end()) == 2);
+    for (auto [a, b] : pairs)
+        a.charge = b.charge = 1;
+    CHECK(v[2].charge == 1);
+    v[1].pos = {5.0, 5.0, 5.0};
+    pairs.update();
+    CHECK(std::distance(pairs.begin(), pairs.end()) == 1);
+}
+#endif
+
+/** Half-open index range [first, second) */
+using index_range = std::pair<std::size_t, std::size_t>;
+
+/**
+ * @brief Split the index range [0,n) into at most `chunks` contiguous, non-empty ranges of equal length (+/- 1)
+ */
+template <class Allocator = std::allocator<index_range>>
+std::vector<index_range, Allocator> split_range(std::size_t n, std::size_t chunks,
+                                                const Allocator &allocator = Allocator()) {
+    chunks = std::max<std::size_t>(1, std::min(chunks, n));
+    std::vector<index_range, Allocator> ranges(allocator);
+    ranges.reserve(chunks);
+    for (std::size_t c = 0, first = 0; c < chunks and n > 0; c++) {
+        auto last = first + n / chunks + (c < n % chunks ? 1 : 0);
+        ranges.emplace_back(first, last);
+        first = last;
+    }
+    return ranges;
+}
+
+/**
+ * @brief Number of chunks to split a parallel pair loop into
+ *
+ * A few chunks per hardware thread lets the execution policy's scheduler even out
+ * differences in runtime between chunks.
+ */
+inline std::size_t default_chunks() { return 4 * std::max(1u, std::thread::hardware_concurrency()); }
+
+/** Threads that may run `chunks` chunks under an execution policy; registered with an instrument */
+template <class ExecutionPolicy> std::size_t policy_workers(std::size_t chunks) {
+    if constexpr (std::is_same<std::decay_t<ExecutionPolicy>, std::execution::sequenced_policy>::value)
+        return 1;
+    else
+        return std::max<std::size_t>(1, std::min<std::size_t>(std::thread::hardware_concurrency(), chunks));
+}
+
+/**
+ * @brief Apply `fn` to all pairs of a random access pair view using an execution policy
+ *
+ * The linear pair index space is split into chunks holding the same number of pairs.
+ * For `internal_pairs`, this is what balances the load: splitting by rows of the triangular
+ * matrix gives the first rows far more work than the last. The function receives the
+ * tuple of references by value and must be safe to call concurrently.
+ * Bookkeeping is allocated from the calling thread's `Arena::local()` arena. Each chunk runs
+ * within an `Arena::scope` of the thread executing it, so scratch memory that `fn` takes from
+ * `Arena::local()` is reclaimed when the chunk ends; it must not outlive the call of `fn`.
+ * An `Instrumentation::recorder` may be given to record pair counts and chunk timings.
+ *
+ * Example:
+ *
+ * ~~~ cpp
+ * parallel_for_pairs(std::execution::par, internal_pairs(v), [](auto pair) {
+ *     auto [i, j] = pair;
+ *     ...
+ * });
+ * ~~~
+ */
+template <class ExecutionPolicy, class Pairs, class Function, class Instrument = Instrumentation::disabled,
+          std::enable_if_t<std::is_execution_policy<std::decay_t<ExecutionPolicy>>::value, int> = 0>
+void parallel_for_pairs(ExecutionPolicy &&policy, Pairs &&pairs, Function fn, std::size_t chunks = default_chunks(),
+                        Instrument &instrument = Instrumentation::off) {
+    using iterator = decltype(pairs.begin());
+    static_assert(std::is_base_of<std::random_access_iterator_tag,
+                                  typename std::iterator_traits<iterator>::iterator_category>::value,
+                  "pair view must be random access");
+    Arena::scope scope;
+    auto first = pairs.begin();
+    auto ranges = split_range(pairs.size(), chunks, std::pmr::polymorphic_allocator<index_range>(scope.resource()));
+    instrument.workers(policy_workers<ExecutionPolicy>(ranges.size()));
+    std::for_each(std::forward<ExecutionPolicy>(policy), ranges.begin(), ranges.end(), [&](const auto &range) {
+        Arena::scope scratch; // for `fn`
+        auto chunk = instrument.chunk(range.first, range.second);
+        std::for_each(first + range.first, first + range.second, fn);
+        chunk.pairs(range.second - range.first);
+    });
+}
+
+template <class Pairs, class = void> struct has_cell_pairs : std::false_type {};
+template <class Pairs>
+struct has_cell_pairs<Pairs, std::void_t<decltype(std::declval<Pairs>().cell_pairs(std::size_t()))>>
+    : std::true_type {};
+template <class Pairs, class = void> struct has_candidate_pairs : std::false_type {};
+template <class Pairs>
+struct has_candidate_pairs<Pairs, std::void_t<decltype(std::declval<Pairs>().candidate_pairs(std::size_t()))>>
+    : std::true_type {};
+
+/**
+ * @brief Apply `fn` to all pairs using a work-stealing thread pool
+ *
+ * For a random access pair view, the pair index space is scheduled in ranges of at least `grain`
+ * pairs. For a view partitioned into cells, such as `cutoff_pairs`, whole cells are scheduled
+ * with `grain` cells per range, so that dense and empty regions balance out by stealing rather
+ * than by equal chunks. A grain of zero picks about 16 ranges per worker for random access views
+ * and one cell per range otherwise. With an `Instrumentation::recorder`, each range is timed and,
+ * for views with `candidate_pairs()`, the pairs skipped by the cutoff are counted too.
+ * As for the execution policy version, ranges run within an `Arena::scope` of the worker.
+ *
+ * Example:
+ *
+ * ~~~ cpp
+ * WorkStealing::pool pool;
+ * parallel_for_pairs(pool, cutoff_pairs(v, &Particle::pos, box, 2.5), [](auto pair) { ... });
+ * ~~~
+ */
+template <class Pairs, class Function, class Instrument = Instrumentation::disabled>
+void parallel_for_pairs(WorkStealing::pool &pool, Pairs &&pairs, Function fn, std::size_t grain = 0,
+                        Instrument &instrument = Instrumentation::off) {
+    instrument.workers(pool.size());
+    if constexpr (has_cell_pairs<Pairs>::value) {
+        pool.parallel_for(0, pairs.cell_count(), grain, [&](std::size_t first, std::size_t last) {
+            Arena::scope scratch;
+            auto chunk = instrument.chunk(first, last);
+            for (auto c = first; c < last; c++) {
+                std::size_t visited = 0;
+                for (auto pair : pairs.cell_pairs(c)) {
+                    fn(pair);
+                    if constexpr (Instrument::enabled)
+                        visited++;
+                }
+                if constexpr (Instrument::enabled) {
+                    chunk.pairs(visited);
+                    if constexpr (has_candidate_pairs<Pairs>::value)
+                        chunk.skipped(pairs.candidate_pairs(c) - visited);
+                }
+            }
+        });
+    } else {
+        using iterator = decltype(pairs.begin());
+        static_assert(std::is_base_of<std::random_access_iterator_tag,
+                                      typename std::iterator_traits<iterator>::iterator_category>::value,
+                      "pair view must be random access or partitioned into cells");
+        auto begin = pairs.begin();
+        auto n = static_cast<std::size_t>(pairs.size());
+        grain = grain > 0 ? grain : std::max<std::size_t>(1, n / (16 * pool.size()));
+        pool.parallel_for(0, n, grain, [&](std::size_t first, std::size_t last) {
+            Arena::scope scratch;
+            auto chunk = instrument.chunk(first, last);
+            std::for_each(begin + first, begin + last, fn);
+            chunk.pairs(last - first);
+        });
+    }
+}
+
+/**
+ * @brief Parallel reduction over all pairs of a random access pair view
+ *
+ * Equivalent to `std::transform_reduce(policy, pairs.begin(), pairs.end(), init, reduce, fn)`
+ * but with each chunk reduced into a private partial result, so no atomics are needed
+ * in `fn`. Partial results are combined in chunk order which makes the result independent
+ * of the number of threads for a given number of chunks. The partial results are
+ * kept in the calling thread's `Arena::local()` arena, so repeated calls do not allocate.
+ * Chunks run within an arena scope and an `Instrumentation::recorder` may be given, both as for
+ * `parallel_for_pairs()`.
+ *
+ * Example:
+ *
+ * ~~~ cpp
+ * double energy = parallel_reduce_pairs(std::execution::par, internal_pairs(v), 0.0, std::plus<>(),
+ *                                       [](auto pair) { auto [i, j] = pair; return u(i, j); });
+ * ~~~
+ */
+template <class ExecutionPolicy, class Pairs, class T, class BinaryOp, class Function,
+          class Instrument = Instrumentation::disabled,
+          std::enable_if_t<std::is_execution_policy<std::decay_t<ExecutionPolicy>>::value, int> = 0>
+T parallel_reduce_pairs(ExecutionPolicy &&policy, Pairs &&pairs, T init, BinaryOp reduce, Function fn,
+                        std::size_t chunks = default_chunks(), Instrument &instrument = Instrumentation::off) {
+    using iterator = decltype(pairs.begin());
+    static_assert(std::is_base_of<std::random_access_iterator_tag,
+                                  typename std::iterator_traits<iterator>::iterator_category>::value,
+                  "pair view must be random access");
+    Arena::scope scope;
+    auto first = pairs.begin();
+    auto ranges = split_range(pairs.size(), chunks, std::pmr::polymorphic_allocator<index_range>(scope.resource()));
+    std::pmr::vector<std::optional<T>> partial(ranges.size(), scope.resource());
+    instrument.workers(policy_workers<ExecutionPolicy>(ranges.size()));
+    std::for_each(std::forward<ExecutionPolicy>(policy), ranges.begin(), ranges.end(), [&](const auto &range) {
+        Arena::scope scratch; // for `fn`; `sum` is a plain value
+        auto chunk = instrument.chunk(range.first, range.second);
+        auto it = first + range.first, last = first + range.second; // chunks are never empty
+        T sum = fn(*it);
+        while (++it != last)
+            sum = reduce(std::move(sum), fn(*it));
+        partial[&range - ranges.data()] = std::move(sum);
+        chunk.pairs(range.second - range.first);
+    });
+    for (auto &sum : partial)
+        init = reduce(std::move(init), std::move(*sum));
+    return init;
+}
+
+/** Zero of an accumulator type; uses `T::Zero()` if available, as for Eigen vectors, otherwise `T{}` */
+template <class T, class = void> struct has_static_zero : std::false_type {};
+template <class T> struct has_static_zero<T, std::void_t<decltype(T::Zero())>> : std::true_type {};
+
+template <class T> T zero_value() {
+    if constexpr (has_static_zero<T>::value)
+        return T::Zero();
+    else
+        return T{};
+}
+
+/**
+ * @brief Apply `kernel` to all unique pairs, adding the result to member of `i` and subtracting it from `j`
+ *
+ * This is Newton's third law: for a pair force f_ij, `v[i].*member += f_ij` and `v[j].*member -= f_ij`
+ * so that the kernel is evaluated once per pair rather than twice as when looping over the full
+ * `cartesian_product(v, v)`. The kernel is called as `kernel(v[i], v[j])` with i<j and must return
+ * something that can be added to and subtracted from the member. The member is not reset.
+ *
+ * Example:
+ *
+ * ~~~ cpp
+ * reduce_pairs_symmetric(particles, &Particle::force,
+ *                        [](const auto &a, const auto &b) { return coulomb_force(a, b); });
+ * ~~~
+ */
+template <class T, class Member, class Kernel,
+          std::enable_if_t<not std::is_execution_policy<std::decay_t<T>>::value, int> = 0>
+void reduce_pairs_symmetric(T &v, Member member, Kernel kernel) {
+    for (auto i = v.begin(); i != v.end(); ++i)
+        for (auto j = std::next(i); j != v.end(); ++j) {
+            auto f = kernel(std::as_const(*i), std::as_const(*j));
+            (*i).*member += f;
+            (*j).*member -= f;
+        }
+}
+
+/**
+ * @brief Add `kernel(v[i], v[j])` to `buffer[i]` and subtract it from `buffer[j]` for the internal pairs
+ *        of `v` with linear indices in `range`, as numbered by `triangular_unrank()`
+ */
+template <class T, class Kernel, class Accumulator>
+void scatter_pairs_symmetric(const T &v, Kernel &kernel, const index_range &range, Accumulator *buffer) {
+    if (range.first == range.second)
+        return;
+    const std::size_t n = v.size();
+    auto [i, j] = triangular_unrank(range.first, n);
+    for (auto k = range.first; k < range.second; k++) {
+        auto f = kernel(v[i], v[j]);
+        buffer[i] += f;
+        buffer[j] -= f;
+        if (++j == n) {
+            i++;
+            j = i + 1;
+        }
+    }
+}
+
+/**
+ * @brief Parallel version of `reduce_pairs_symmetric()` using an execution policy
+ *
+ * As in `parallel_for_pairs()`, the pair index space is split into chunks holding the same
+ * number of pairs. Each chunk scatters into a private, zeroed buffer for all elements so that
+ * no two threads write the same memory, and buffers are then merged element-wise with the same
+ * policy, in chunk order, which makes the result independent of scheduling. The buffers take
+ * `chunks * v.size()` accumulators, hence one chunk per hardware thread is the default. They come
+ * from the calling thread's `Arena::local()` arena up to `Arena::retain_limit` bytes and from the
+ * heap above, so that their memory is returned after the call. Chunks of the pair loop run within
+ * an arena scope as in `parallel_for_pairs()`, and an `Instrumentation::recorder` times them.
+ */
+template <class ExecutionPolicy, class T, class Member, class Kernel, class Instrument = Instrumentation::disabled,
+          std::enable_if_t<std::is_execution_policy<std::decay_t<ExecutionPolicy>>::value, int> = 0>
+void reduce_pairs_symmetric(ExecutionPolicy &&policy, T &v, Member member, Kernel kernel,
+                            std::size_t chunks = std::max(1u, std::thread::hardware_concurrency()),
+                            Instrument &instrument = Instrumentation::off) {
+    using accumulator = std::decay_t<decltype(v[0].*member)>;
+    const std::size_t n = v.size();
+    Arena::scope scope;
+    auto ranges = split_range(n * (n - (n > 0)) / 2, chunks,
+                              std::pmr::polymorphic_allocator<index_range>(scope.resource()));
+    std::pmr::vector<accumulator> buffers(ranges.size() * n, zero_value<accumulator>(),
+                                          scope.resource(ranges.size() * n * sizeof(accumulator)));
+    instrument.workers(policy_workers<ExecutionPolicy>(ranges.size()));
+    std::for_each(policy, ranges.begin(), ranges.end(), [&](const auto &range) {
+        Arena::scope scratch; // for `kernel`
+        auto chunk = instrument.chunk(range.first, range.second);
+        scatter_pairs_symmetric(v, kernel, range, buffers.data() + (&range - ranges.data()) * n);
+        chunk.pairs(range.second - range.first);
+    });
+    auto elements = split_range(n, default_chunks(), std::pmr::polymorphic_allocator<index_range>(scope.resource()));
+    std::for_each(std::forward<ExecutionPolicy>(policy), elements.begin(), elements.end(), [&](const auto &range) {
+        for (std::size_t c = 0; c < ranges.size(); c++) {
+            auto buffer = buffers.data() + c * n;
+            for (auto i = range.first; i < range.second; i++)
+                v[i].*member += buffer[i];
+        }
+    });
+}
+
+/**
+ * @brief Fixed width batch of (i,j) index pairs as yielded by `pair_batches()`
+ *
+ * Only the first `size` lanes are valid; the remaining lanes of the last batch repeat the
+ * last valid pair so that they can be gathered safely and then masked out with `active()`.
+ * Most batches lie within one row; then `contiguous` is set and a kernel can broadcast
+ * element `i[0]` and load elements `j[0]` to `j[0] + W - 1` contiguously instead of gathering.
+ */
+template <std::size_t W, class Index = std::uint32_t> struct pair_batch {
+    static constexpr std::size_t width = W;
+    static constexpr std::size_t bytes = W * sizeof(Index);                          // size of each lane array
+    static constexpr std::size_t alignment = std::min<std::size_t>(64, bytes & -bytes); // largest power of 2 in it
+    alignas(alignment) std::array<Index, W> i; // first index of each lane
+    alignas(alignment) std::array<Index, W> j; // second index of each lane
+    std::size_t size = 0;                      // number of valid lanes
+    bool contiguous = false;                   // all lanes valid with the same i and j = j[0], j[0] + 1, ...
+    inline bool active(std::size_t lane) const { return lane < size; }
+};
+
+/**
+ * @brief Iterator view to the unique pairs of `n` indices in batches of `W`
+ *
+ * Pairs are enumerated in the same order as `internal_pairs` but dereferencing yields a
+ * `pair_batch` of `W` index pairs rather than one tuple of references. A kernel can then
+ * loop over the lanes, reading from e.g. a `soa_vector` or Eigen columns, and let the compiler
+ * vectorize across the batch. Batches within one row are flagged `contiguous`: the kernel should
+ * then broadcast `i[0]` and load from `j[0]` on, as a plain double loop would, and gather only
+ * for the few batches spanning rows. The iterator is random access, with one step per batch,
+ * so the view can be given to `parallel_for_pairs`.
+ *
+ * Example:
+ *
+ * ~~~ cpp
+ * for (const auto &b : pair_batches<16>(v)) {
+ *     std::array<double, 16> r2;
+ *     if (b.contiguous)
+ *         for (std::size_t lane = 0; lane < b.width; lane++)
+ *             r2[lane] = squared_distance(x[b.i[0]], x[b.j[0] + lane]);
+ *     else
+ *         for (std::size_t lane = 0; lane < b.width; lane++)
+ *             r2[lane] = squared_distance(x[b.i[lane]], x[b.j[lane]]);
+ *     for (std::size_t lane = 0; lane < b.width; lane++)
+ *         u += b.active(lane) ? potential(r2[lane]) : 0.0;
+ * }
+ * ~~~
+ */
+template <std::size_t W, class Index = std::uint32_t> class pair_batch_view {
+    static_assert(W > 0, "batch width must be positive");
+    std::size_t n; // number of elements
+
+  public:
+    using batch = pair_batch<W, Index>;
+
+    class iterator {
+      public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = batch;
+        using reference = batch;
+        using pointer = void;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() = default;
+        iterator(std::size_t n, difference_type b) : n(n) { seek(b); }
+
+        inline batch operator*() const {
+            batch out;
+            const std::size_t pairs = n * (n - 1) / 2;
+            out.size = std::min(W, pairs - static_cast<std::size_t>(b) * W);
+            std::size_t i = this->i, j = this->j;
+            for (std::size_t lane = 0; lane < out.size; i++, j = i + 1) { // one run of lanes per row
+                const auto run = std::min(out.size - lane, n - j);
+                for (std::size_t t = 0; t < run; t++) {
+                    out.i[lane + t] = static_cast<Index>(i);
+                    out.j[lane + t] = static_cast<Index>(j + t);
+                }
+                lane += run;
+            }
+            for (std::size_t lane = out.size; lane < W; lane++) { // the rest repeats the last valid pair
+                out.i[lane] = out.i[out.size - 1];
+                out.j[lane] = out.j[out.size - 1];
+            }
+            out.contiguous = out.size == W and out.i[0] == out.i[W - 1];
+            return out;
+        }
+        inline batch operator[](difference_type d) const { return *(*this + d); }
+        inline iterator &operator++() {
+            b++;
+            for (std::size_t remaining = W; remaining > 0 and i + 1 < n;) { // advance (i,j) by W pairs
+                const std::size_t row_left = n - j;
+                if (remaining < row_left) {
+                    j += remaining;
+                    break;
+                }
+                remaining -= row_left;
+                i++;
+                j = i + 1;
+            }
+            return *this;
+        }
+        inline iterator &operator--() {
+            seek(b - 1);
+            return *this;
+        }
+        inline iterator operator++(int) {
+            auto tmp = *this;
+            ++*this;
+            return tmp;
+        }
+        inline iterator operator--(int) {
+            auto tmp = *this;
+            --*this;
+            return tmp;
+        }
+        inline iterator &operator+=(difference_type d) {
+            seek(b + d);
+            return *this;
+        }
+        inline iterator &operator-=(difference_type d) { return *this += -d; }
+        inline iterator operator+(difference_type d) const { return iterator(*this) += d; }
+        inline iterator operator-(difference_type d) const { return iterator(*this) -= d; }
+        friend inline iterator operator+(difference_type d, const iterator &it) { return it + d; }
+        inline difference_type operator-(const iterator &other) const { return b - other.b; }
+        inline bool operator==(const iterator &other) const { return b == other.b; }
+        inline bool operator!=(const iterator &other) const { return b != other.b; }
+        inline bool operator<(const iterator &other) const { return b < other.b; }
+        inline bool operator>(const iterator &other) const { return b > other.b; }
+        inline bool operator<=(const iterator &other) const { return b <= other.b; }
+        inline bool operator>=(const iterator &other) const { return b >= other.b; }
+
+      private:
+        std::size_t n = 0, i = 0, j = 0; // number of elements; first pair of the batch
+        difference_type b = 0;            // batch index
+
+        void seek(difference_type b) {
+            this->b = b;
+            auto k = static_cast<std::size_t>(b) * W;
+            if (n > 1 and k < n * (n - 1) / 2)
+                std::tie(i, j) = triangular_unrank(k, n);
+            else
+                i = j = n;
+        }
+    };
+
+    explicit pair_batch_view(std::size_t n) : n(n) {}
+    iterator begin() const { return iterator(n, 0); }
+    iterator end() const { return iterator(n, size()); }
+
+    /** Number of batches */
+    std::size_t size() const { return n < 2 ? 0 : (n * (n - 1) / 2 + W - 1) / W; }
+};
+
+/** Batches of `W` index pairs for the unique pairs in container `v`; see `pair_batch_view` */
+template <std::size_t W, class Index = std::uint32_t, class T> pair_batch_view<W, Index> pair_batches(const T &v) {
+    return pair_batch_view<W, Index>(std::size(v));
+}
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE_TEMPLATE("pair_batches", T, std::integral_constant<std::size_t, 1>, std::integral_constant<std::size_t, 3>,
+                   std::integral_constant<std::size_t, 4>, std::integral_constant<std::size_t, 16>) {
+    constexpr std::size_t W = T::value;
+    for (std::size_t n : {0, 1, 2, 3, 7, 20}) {
+        std::vector<int> v(n);
+        std::vector<std::pair<std::size_t, std::size_t>> expected, batched;
+        for (std::size_t i = 0; i < n; i++)
+            for (std::size_t j = i + 1; j < n; j++)
+                expected.emplace_back(i, j);
+
+        auto batches = pair_batches<W>(v);
+        CHECK(std::distance(batches.begin(), batches.end()) == static_cast<std::ptrdiff_t>(batches.size()));
+        std::size_t count = 0;
+        for (auto it = batches.begin(); it != batches.end(); ++it) {
+            auto b = *it;
+            auto sought = batches.begin() + count++;
+            CHECK((*sought).i == b.i); // random access agrees with stepping
+            CHECK((*sought).j == b.j);
+            CHECK(b.size > 0);
+            CHECK(reinterpret_cast<std::uintptr_t>(b.j.data()) % b.alignment == 0);
+            for (std::size_t lane = 0; lane < W; lane++) {
+                if (b.contiguous)
+                    CHECK((b.i[lane] == b.i[0] and b.j[lane] == b.j[0] + lane));
+                CHECK(b.i[lane] < b.j[lane]);
+                CHECK(b.j[lane] < n);
+                if (b.active(lane))
+                    batched.emplace_back(b.i[lane], b.j[lane]);
+            }
+        }
+        CHECK(batched == expected);
+    }
+
+    std::vector<int> v(50);
+    std::atomic<std::size_t> lanes = 0;
+    parallel_for_pairs(std::execution::par, pair_batches<W>(v), [&](const auto &b) { lanes += b.size; });
+    CHECK(lanes == 50 * 49 / 2);
+}
+#endif
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE("split_range") {
+    using range = std::pair<std::size_t, std::size_t>;
+    CHECK(split_range(10, 3) == std::vector<range>{{0, 4}, {4, 7}, {7, 10}});
+    CHECK(split_range(2, 4) == std::vector<range>{{0, 1}, {1, 2}});
+    CHECK(split_range(0, 4).empty());
+}
+
+TEST_CASE("parallel_for_pairs") {
+    std::vector<int> v(200);
+    std::iota(v.begin(), v.end(), 0);
+    int pair_sum = 0; // sum of all i*j
+    for (auto [i, j] : internal_pairs(v))
+        pair_sum += i * j;
+
+    SUBCASE("std::for_each on random access iterator") {
+        std::atomic<int> sum = 0;
+        internal_pairs pairs(v);
+        std::for_each(std::execution::par, pairs.begin(), pairs.end(), [&](auto pair) {
+            auto [i, j] = pair;
+            sum += i * j;
+        });
+        CHECK(sum == pair_sum);
+        std::vector<int> products(pairs.size()); // unsequenced: no synchronization, one slot per pair
+        const std::size_t n = v.size();
+        std::for_each(std::execution::par_unseq, pairs.begin(), pairs.end(), [&](auto pair) {
+            auto [i, j] = pair; // values equal indices
+            products[std::size_t(i) * n - std::size_t(i) * (i + 1) / 2 + (j - i - 1)] = i * j;
+        });
+        CHECK(std::accumulate(products.begin(), products.end(), 0) == pair_sum);
+    }
+
+    SUBCASE("internal_pairs") {
+        std::atomic<int> sum = 0;
+        std::atomic<std::size_t> cnt = 0;
+        parallel_for_pairs(std::execution::par, internal_pairs(v), [&](auto pair) {
+            auto [i, j] = pair;
+            sum += i * j;
+            cnt++;
+        });
+        CHECK(sum == pair_sum);
+        CHECK(cnt == v.size() * (v.size() - 1) / 2);
+    }
+
+    SUBCASE("cartesian_product") {
+        std::atomic<int> sum = 0;
+        parallel_for_pairs(std::execution::par, cartesian_product(v.begin(), v.begin() + 3, v.begin(), v.end()),
+                           [&](auto pair) { sum += std::get<0>(pair) + std::get<1>(pair); });
+        CHECK(sum == 200 * (0 + 1 + 2) + 3 * std::accumulate(v.begin(), v.end(), 0));
+    }
+
+    SUBCASE("work stealing pool") {
+        WorkStealing::pool pool(3);
+        for (std::size_t grain : {0, 1, 1000}) {
+            std::atomic<int> sum = 0;
+            auto product = [&](auto pair) { sum += std::get<0>(pair) * std::get<1>(pair); };
+            parallel_for_pairs(pool, internal_pairs(v), product, grain);
+            CHECK(sum == pair_sum);
+        }
+        std::atomic<int> sum = 0;
+        parallel_for_pairs(pool, cartesian_product(v.begin(), v.begin() + 3, v.begin(), v.end()),
+                           [&](auto pair) { sum += std::get<0>(pair) + std::get<1>(pair); });
+        CHECK(sum == 200 * (0 + 1 + 2) + 3 * std::accumulate(v.begin(), v.end(), 0));
+
+        struct atom {
+            std::array<double, 3> pos;
+        };
+        std::vector<atom> atoms(500); // clustered in one corner of the box
+        std::mt19937 engine;
+        std::uniform_real_distribution<double> random(0.0, 1.0);
+        for (auto &a : atoms)
+            a.pos = {std::pow(random(engine), 4) * 10, random(engine) * 10, random(engine) * 10};
+        cutoff_pairs pairs(atoms, &atom::pos, std::array<double, 3>{10, 10, 10}, 1.0);
+        std::atomic<std::size_t> cnt = 0;
+        parallel_for_pairs(pool, pairs, [&](auto) { cnt++; });
+        CHECK(cnt == std::size_t(std::distance(pairs.begin(), pairs.end())));
+
+        Instrumentation::recorder stats;
+        parallel_for_pairs(pool, pairs, [](auto) {}, 4, stats);
+        std::size_t candidates = 0;
+        for (std::size_t c = 0; c < pairs.cell_count(); c++)
+            candidates += pairs.candidate_pairs(c);
+        CHECK(stats.pairs() == cnt);
+        CHECK(stats.pairs() + stats.skipped() == candidates);
+        CHECK(stats.skipped() > 0);
+        CHECK(stats.chunks() >= (pairs.cell_count() + 3) / 4); // ranges of at most 4 cells
+        stats.clear();
+        parallel_for_pairs(pool, internal_pairs(v), [](auto) {}, 1000, stats);
+        CHECK(stats.pairs() == v.size() * (v.size() - 1) / 2);
+        CHECK(stats.skipped() == 0);
+    }
+
+    SUBCASE("cartesian_product of three ranges") {
+        std::atomic<long> sum = 0;
+        std::vector<double> c = {0.5, 1.5};
+        parallel_for_pairs(std::execution::par, cartesian_product(v, v, c), [&](auto t) { sum += std::get<0>(t); });
+        CHECK(sum == 2L * 200 * 199 * 200 / 2);
+    }
+
+    SUBCASE("combinations") {
+        std::atomic<long> sum = 0;
+        parallel_for_pairs(std::execution::par, combinations<3>(v), [&](auto triplet) {
+            auto [i, j, k] = triplet;
+            sum += i + j + k;
+        });
+        CHECK(sum == long(binomial(199, 2) * 199 * 200 / 2)); // each index is in (n-1 choose 2) triplets
+    }
+
+    SUBCASE("reduction") {
+        auto product = [](auto pair) { return std::get<0>(pair) * std::get<1>(pair); };
+        CHECK(parallel_reduce_pairs(std::execution::par, internal_pairs(v), 0, std::plus<>(), product) == pair_sum);
+        CHECK(parallel_reduce_pairs(std::execution::seq, internal_pairs(v), 10, std::plus<>(), product, 1) ==
+              pair_sum + 10);
+        std::vector<int> empty;
+        CHECK(parallel_reduce_pairs(std::execution::par, internal_pairs(empty), 10, std::plus<>(), product) == 10);
+    }
+
+    SUBCASE("kernel scratch from the arena") {
+        auto product = [](auto pair) {
+            std::pmr::vector<int> scratch(128, std::get<0>(pair), &Arena::local()); // 512 bytes per pair
+            return scratch.back() * std::get<1>(pair);
+        };
+        std::size_t capacity = 0;
+        std::thread([&] { // fresh arena; about 10 MB if scratch were kept for the whole loop
+            CHECK(parallel_reduce_pairs(std::execution::seq, internal_pairs(v), 0, std::plus<>(), product, 100) ==
+                  pair_sum);
+            parallel_for_pairs(std::execution::seq, internal_pairs(v), product, 100);
+            capacity = Arena::local().capacity();
+        }).join();
+        CHECK(capacity < 1024 * 1024); // one chunk, 200 pairs, at a time
+    }
+
+    SUBCASE("instrumentation") {
+        Instrumentation::recorder stats;
+        parallel_for_pairs(std::execution::par, internal_pairs(v), [](auto) {}, 7, stats);
+        CHECK(stats.pairs() == v.size() * (v.size() - 1) / 2);
+        CHECK(stats.chunks() == 7);
+        CHECK(stats.imbalance() >= 1.0);
+        auto product = [](auto pair) { return std::get<0>(pair) * std::get<1>(pair); };
+        CHECK(parallel_reduce_pairs(std::execution::par, internal_pairs(v), 0, std::plus<>(), product, 3, stats) ==
+              pair_sum);
+        CHECK(stats.chunks() == 10);
+        CHECK(stats.pairs() == v.size() * (v.size() - 1));
+        stats.clear();
+        parallel_for_pairs(std::execution::seq, internal_pairs(v), [](auto) {}, 7, stats);
+        CHECK(stats.imbalance() == doctest::Approx(1.0)); // one worker, which did everything
+    }
+}
+
+TEST_CASE("reduce_pairs_symmetric") {
+    struct particle {
+        double x, force = 0;
+    };
+    std::vector<particle> v(50);
+    for (std::size_t i = 0; i < v.size(); i++)
+        v[i].x = std::sin(i);
+    auto kernel = [](const particle &a, const particle &b) { return a.x - b.x; };
+
+    std::vector<double> expected(v.size(), 0); // from the full N x N product
+    for (std::size_t i = 0; i < v.size(); i++)
+        for (std::size_t j = 0; j < v.size(); j++)
+            expected[i] += i == j ? 0.0 : kernel(v[i], v[j]);
+
+    SUBCASE("serial") {
+        reduce_pairs_symmetric(v, &particle::force, kernel);
+        for (std::size_t i = 0; i < v.size(); i++)
+            CHECK(v[i].force == doctest::Approx(expected[i]));
+    }
+    SUBCASE("parallel") {
+        for (std::size_t chunks : {1, 3, 8, 5000}) {
+            for (auto &p : v)
+                p.force = 0;
+            reduce_pairs_symmetric(std::execution::par, v, &particle::force, kernel, chunks);
+            for (std::size_t i = 0; i < v.size(); i++)
+                CHECK(v[i].force == doctest::Approx(expected[i]));
+        }
+    }
+    SUBCASE("list and empty container") {
+        std::list<particle> l(v.begin(), v.end());
+        for (auto &p : l)
+            p.force = 0;
+        reduce_pairs_symmetric(l, &particle::force, kernel);
+        CHECK(l.front().force == doctest::Approx(expected.front()));
+        std::vector<particle> empty;
+        reduce_pairs_symmetric(std::execution::par, empty, &particle::force, kernel);
+    }
+    SUBCASE("large buffers are not kept in the arena") {
+        std::vector<particle> many(1000);
+        for (std::size_t i = 0; i < many.size(); i++)
+            many[i].x = std::sin(i);
+        const std::size_t chunks = 3000; // 24 MB of buffers
+        REQUIRE(chunks * many.size() * sizeof(double) > Arena::retain_limit);
+        const auto capacity = Arena::local().capacity();
+        reduce_pairs_symmetric(std::execution::par, many, &particle::force, kernel, chunks);
+        CHECK(Arena::local().capacity() < capacity + Arena::retain_limit);
+        double sum_x = 0;
+        for (auto &p : many)
+            sum_x += p.x;
+        CHECK(many[0].force == doctest::Approx(1000 * many[0].x - sum_x));
+    }
+#ifdef EIGEN_CORE_H
+    SUBCASE("Eigen accumulator") {
+        struct atom {
+            Eigen::Vector3d pos, force = Eigen::Vector3d::Zero();
+        };
+        std::vector<atom> atoms(20);
+        for (auto &a : atoms)
+            a.pos.setRandom();
+        reduce_pairs_symmetric(std::execution::par, atoms, &atom::force,
+                               [](const auto &a, const auto &b) -> Eigen::Vector3d { return a.pos - b.pos; });
+        Eigen::Vector3d net = Eigen::Vector3d::Zero();
+        for (auto &a : atoms)
+            net += a.force;
+        CHECK(net.norm() == doctest::Approx(0).epsilon(1e-12)); // forces cancel pairwise
+        double sum_x = 0;
+        for (auto &a : atoms)
+            sum_x += a.pos.x();
+        CHECK(atoms[0].force.x() == doctest::Approx(20 * atoms[0].pos.x() - sum_x));
+    }
+#endif
 }
 #endif
 } // namespace PairwiseIterator
@@ -0,0 +1,197 @@
+/*
+ *  Copyright (C) 2020-present  Mikael Lund (github.com/mlund/cpptricks)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include "invsqrt.h"
+#include "pairwise_iterator.h"
+#include <Eigen/Core>
+#include <array>
+#include <cmath>
+#include <cstddef>
+
+namespace PeriodicBoundary {
+
+/**
+ * @brief Cubic periodic box
+ *
+ * Like the other boxes, `minimum_image()` folds a distance vector into [-L/2, L/2) using
+ * `floor(x + 0.5)` rather than `std::round`, which the compiler can turn into a single
+ * rounding instruction and vectorize across lanes.
+ */
+struct cubic {
+    double side, inverse_side;
+    explicit cubic(double side) : side(side), inverse_side(1.0 / side) {}
+    template <class T> inline void minimum_image(T &dx, T &dy, T &dz) const {
+        dx -= side * std::floor(dx * inverse_side + 0.5);
+        dy -= side * std::floor(dy * inverse_side + 0.5);
+        dz -= side * std::floor(dz * inverse_side + 0.5);
+    }
+};
+
+/** Rectangular periodic box with side lengths along x, y and z */
+struct orthorhombic {
+    Eigen::Vector3d side, inverse_side;
+    explicit orthorhombic(const Eigen::Vector3d &side) : side(side), inverse_side(side.cwiseInverse()) {}
+    template <class T> inline void minimum_image(T &dx, T &dy, T &dz) const {
+        dx -= side.x() * std::floor(dx * inverse_side.x() + 0.5);
+        dy -= side.y() * std::floor(dy * inverse_side.y() + 0.5);
+        dz -= side.z() * std::floor(dz * inverse_side.z() + 0.5);
+    }
+};
+
+/**
+ * @brief Triclinic periodic box spanned by the columns of an upper triangular matrix
+ *
+ * The box vectors a = (ax, 0, 0), b = (bx, by, 0), c = (cx, cy, cz) are the usual restricted
+ * form, as in e.g. LAMMPS and GROMACS. Whole box vectors are subtracted from z down to x, so
+ * that each step only touches the components below it. As with the usual pair search in
+ * triclinic boxes, the result is the minimum image whenever that is shorter than half the
+ * smallest box height; longer distances may come out as another, longer image.
+ */
+struct triclinic {
+    Eigen::Matrix3d h; // box vectors as columns
+    explicit triclinic(const Eigen::Matrix3d &h) : h(h) {
+        eigen_assert(h(1, 0) == 0 and h(2, 0) == 0 and h(2, 1) == 0 && "box matrix must be upper triangular");
+    }
+    template <class T> inline void minimum_image(T &dx, T &dy, T &dz) const {
+        T s = std::floor(dz / h(2, 2) + 0.5); // whole c vectors
+        dx -= s * h(0, 2);
+        dy -= s * h(1, 2);
+        dz -= s * h(2, 2);
+        s = std::floor(dy / h(1, 1) + 0.5); // whole b vectors
+        dx -= s * h(0, 1);
+        dy -= s * h(1, 1);
+        dx -= h(0, 0) * std::floor(dx / h(0, 0) + 0.5);
+    }
+};
+
+/** Squared minimum image distance between two positions */
+template <class Box, class Vector> double squared_distance(const Box &box, const Vector &a, const Vector &b) {
+    double dx = a[0] - b[0], dy = a[1] - b[1], dz = a[2] - b[2];
+    box.minimum_image(dx, dy, dz);
+    return dx * dx + dy * dy + dz * dz;
+}
+
+/**
+ * @brief Squared minimum image distances of a batch of index pairs
+ *
+ * `positions` is any N x 3 Eigen expression with one position per row, e.g. `asEigenMatrix(v, &Particle::pos)`
+ * on a `soa_vector`, which gives unit stride columns, or on a vector of structures. The lanes of the
+ * batch are independent so the loop vectorizes once the coordinates are gathered. Inactive lanes
+ * repeat the last pair and are computed as well.
+ *
+ * Example:
+ *
+ * ~~~ cpp
+ * PeriodicBoundary::cubic box(10.0);
+ * auto pos = asEigenMatrix(v, &Particle::pos);
+ * std::array<double, 16> r2;
+ * for (const auto &b : pair_batches<16>(v)) {
+ *     PeriodicBoundary::squared_distances(box, pos, b, r2);
+ *     ...
+ * }
+ * ~~~
+ */
+template <class Box, class Positions, std::size_t W, class Index>
+void squared_distances(const Box &box, const Positions &positions, const PairwiseIterator::pair_batch<W, Index> &b,
+                       std::array<double, W> &r2) {
+    for (std::size_t lane = 0; lane < W; lane++) {
+        double dx = positions(b.i[lane], 0) - positions(b.j[lane], 0);
+        double dy = positions(b.i[lane], 1) - positions(b.j[lane], 1);
+        double dz = positions(b.i[lane], 2) - positions(b.j[lane], 2);
+        box.minimum_image(dx, dy, dz);
+        r2[lane] = dx * dx + dy * dy + dz * dz;
+    }
+}
+
+/**
+ * @brief Squared and inverse minimum image distances of a batch of index pairs, in one pass
+ *
+ * As `squared_distances()` but each lane also gets 1/r from `inv_sqrt<double, iterations>()`
+ * so that the coordinates are read once for both. Coincident positions give an infinite or
+ * undefined inverse distance.
+ */
+template <char iterations = 2, class Box, class Positions, std::size_t W, class Index>
+void inverse_distances(const Box &box, const Positions &positions, const PairwiseIterator::pair_batch<W, Index> &b,
+                       std::array<double, W> &r2, std::array<double, W> &inverse_r) {
+    for (std::size_t lane = 0; lane < W; lane++) {
+        double dx = positions(b.i[lane], 0) - positions(b.j[lane], 0);
+        double dy = positions(b.i[lane], 1) - positions(b.j[lane], 1);
+        double dz = positions(b.i[lane], 2) - positions(b.j[lane], 2);
+        box.minimum_image(dx, dy, dz);
+        r2[lane] = dx * dx + dy * dy + dz * dz;
+        inverse_r[lane] = inv_sqrt<double, iterations>(r2[lane]);
+    }
+}
+
+} // namespace PeriodicBoundary
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+#include <Eigen/Geometry> // cross product and determinant
+#include <random>
+
+TEST_CASE("pbc_distance") {
+    using namespace PeriodicBoundary;
+    std::mt19937 engine;
+    std::uniform_real_distribution<double> random(-15.0, 15.0);
+    Eigen::Matrix<double, Eigen::Dynamic, 3> positions(40, 3);
+    for (Eigen::Index i = 0; i < positions.rows(); i++)
+        positions.row(i) << random(engine), random(engine), random(engine);
+
+    // brute force search over the 9^3 nearest images
+    auto minimum_image_r2 = [](const Eigen::Matrix3d &h, const Eigen::Vector3d &d) {
+        double r2_min = HUGE_VAL;
+        for (int i = -4; i <= 4; i++)
+            for (int j = -4; j <= 4; j++)
+                for (int k = -4; k <= 4; k++)
+                    r2_min = std::min(r2_min, (d + h * Eigen::Vector3d(i, j, k)).squaredNorm());
+        return r2_min;
+    };
+    auto check = [&](const auto &box, const Eigen::Matrix3d &h) {
+        const Eigen::Vector3d a = h.col(0), b = h.col(1), c = h.col(2); // smallest distance between lattice planes:
+        const double height = h.determinant() / std::max({a.cross(b).norm(), b.cross(c).norm(), c.cross(a).norm()});
+        std::array<double, 8> r2, r2_fused, inverse_r;
+        std::vector<int> dummy(positions.rows());
+        for (const auto &batch : PairwiseIterator::pair_batches<8>(dummy)) {
+            squared_distances(box, positions, batch, r2);
+            inverse_distances(box, positions, batch, r2_fused, inverse_r);
+            for (std::size_t lane = 0; lane < batch.size; lane++) {
+                const auto i = batch.i[lane], j = batch.j[lane];
+                Eigen::Vector3d d = positions.row(i) - positions.row(j);
+                const double r2_min = minimum_image_r2(h, d);
+                if (r2_min < 0.25 * height * height)
+                    CHECK(r2[lane] == doctest::Approx(r2_min));
+                else
+                    CHECK(r2[lane] >= r2_min * (1 - 1e-12)); // some image; exact for orthogonal boxes
+                if (h.isDiagonal())
+                    CHECK(r2[lane] == doctest::Approx(r2_min));
+                CHECK(r2_fused[lane] == r2[lane]);
+                CHECK(inverse_r[lane] * std::sqrt(r2[lane]) == doctest::Approx(1.0).epsilon(1e-6));
+                CHECK(squared_distance(box, Eigen::Vector3d(positions.row(i)), Eigen::Vector3d(positions.row(j))) ==
+                      r2[lane]);
+            }
+        }
+    };
+    check(cubic(10.0), 10.0 * Eigen::Matrix3d::Identity());
+    Eigen::Vector3d sides(10.0, 7.0, 12.0);
+    check(orthorhombic(sides), sides.asDiagonal());
+    Eigen::Matrix3d h;
+    h << 10.0, 3.0, -2.0, // columns are box vectors
+        0.0, 8.0, 1.5,    //
+        0.0, 0.0, 9.0;
+    check(triclinic(h), h);
+}
+#endif
@@ -0,0 +1,377 @@
+/*
+ *  Copyright (C) 2020-present  Mikael Lund (github.com/mlund/cpptricks)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <Eigen/Core>
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace SoA {
+
+/** Scalar type and number of scalars of a data member; either arithmetic or a fixed size Eigen object */
+template <class M, class = void> struct member_traits {
+    static_assert(std::is_arithmetic<M>::value, "member must be arithmetic or a fixed size Eigen object");
+    using scalar = M;
+    static constexpr std::ptrdiff_t size = 1;
+};
+
+template <class M> struct member_traits<M, std::void_t<typename M::Scalar>> {
+    static_assert(M::SizeAtCompileTime != Eigen::Dynamic, "member must be a fixed size Eigen object");
+    using scalar = typename M::Scalar;
+    static constexpr std::ptrdiff_t size = M::SizeAtCompileTime;
+};
+
+/** Traits of the data member pointed to by a pointer to member of type `P` */
+template <class P> struct member_pointer_traits;
+template <class T, class M> struct member_pointer_traits<M T::*> : member_traits<M> {};
+
+} // namespace SoA
+
+/**
+ * @brief Structure of arrays container for selected data members of `T`
+ *
+ * Each data member in `Members` is stored in its own buffer as an `N x size` column major
+ * matrix, i.e. all x coordinates, then all y coordinates etc. Every column is contiguous and
+ * aligned so that `asEigenMatrix()` and `asEigenVector()` give unit stride, vectorizable
+ * views, unlike the strided maps into a `std::vector<T>`. Members that are not listed are
+ * not stored.
+ *
+ * Elements are accessed through proxy references which gather and scatter whole `T`
+ * objects, and give access to individual members with `get()`. Iterators are random
+ * access so that e.g. `internal_pairs` works unchanged:
+ *
+ * ~~~ cpp
+ * struct Particle {
+ *     Eigen::Vector3d pos;
+ *     double charge;
+ * };
+ * soa_vector<Particle, &Particle::pos, &Particle::charge> v(10);
+ * auto m = asEigenMatrix(v, &Particle::pos);     // --> 10x3 map with unit inner stride
+ * auto q = asEigenVector(v, &Particle::charge);  // --> 10x1 contiguous map
+ * for (auto [a, b] : PairwiseIterator::internal_pairs(v))
+ *     u += a.get(&Particle::charge) * b.get(&Particle::charge);
+ * ~~~
+ */
+template <class T, auto... Members> class soa_vector {
+    static_assert(sizeof...(Members) > 0, "at least one data member must be given");
+
+    template <auto Member> using scalar_of = typename SoA::member_pointer_traits<decltype(Member)>::scalar;
+    template <auto Member> using buffer = std::vector<scalar_of<Member>, Eigen::aligned_allocator<scalar_of<Member>>>;
+
+    static constexpr std::size_t padding = std::max(1, EIGEN_MAX_ALIGN_BYTES); // capacity multiple; aligns columns
+
+    std::tuple<buffer<Members>...> buffers;
+    std::size_t n = 0, n_max = 0; // size; capacity, i.e. distance between columns
+
+    /** Calls `f(member, buffer)` for each stored data member */
+    template <class Function> void for_each_member(Function f) {
+        std::apply([&](auto &... b) { (f(Members, b), ...); }, buffers);
+    }
+    template <class Function> void for_each_member(Function f) const {
+        std::apply([&](auto &... b) { (f(Members, b), ...); }, buffers);
+    }
+
+    /** First element of the buffer storing member `m` of type `M` */
+    template <class M> auto *find(M T::*m) const {
+        using scalar = typename SoA::member_traits<M>::scalar;
+        const scalar *ptr = nullptr;
+        for_each_member([&](auto member, auto &b) {
+            if constexpr (std::is_same<decltype(member), M T::*>::value)
+                if (member == m)
+                    ptr = b.data();
+        });
+        assert(ptr != nullptr && "data member is not stored in this soa_vector");
+        return ptr;
+    }
+
+    template <bool Const> class basic_reference {
+        using container = std::conditional_t<Const, const soa_vector, soa_vector>;
+        container *v;
+        std::size_t i;
+
+      public:
+        basic_reference(container *v, std::size_t i) : v(v), i(i) {}
+        basic_reference(const basic_reference<false> &other) : v(other.v), i(other.i) {}
+
+        /** Reference to data member `m`; a strided Eigen map for Eigen members */
+        template <class M> decltype(auto) get(M T::*m) const {
+            using scalar = std::conditional_t<Const, const typename SoA::member_traits<M>::scalar,
+                                              typename SoA::member_traits<M>::scalar>;
+            auto ptr = const_cast<scalar *>(v->find(m)) + i;
+            if constexpr (std::is_arithmetic<M>::value)
+                return *ptr;
+            else
+                return Eigen::Map<std::conditional_t<Const, const M, M>, Eigen::Unaligned, Eigen::InnerStride<>>(
+                    ptr, Eigen::InnerStride<>(v->n_max));
+        }
+
+        /** Gathers the stored members into a `T` object; other members are value initialized */
+        operator T() const {
+            T value{};
+            v->for_each_member([&](auto member, auto &b) {
+                auto &x = value.*member;
+                if constexpr (std::is_arithmetic<std::decay_t<decltype(x)>>::value)
+                    x = b[i];
+                else
+                    for (std::ptrdiff_t c = 0; c < x.size(); c++)
+                        x.data()[c] = b[i + c * v->n_max];
+            });
+            return value;
+        }
+
+        /** Scatters the stored members of `value` into the container */
+        template <bool _Const = Const>
+        std::enable_if_t<not _Const, const basic_reference &> operator=(const T &value) const {
+            v->for_each_member([&](auto member, auto &b) {
+                const auto &x = value.*member;
+                if constexpr (std::is_arithmetic<std::decay_t<decltype(x)>>::value)
+                    b[i] = x;
+                else
+                    for (std::ptrdiff_t c = 0; c < x.size(); c++)
+                        b[i + c * v->n_max] = x.data()[c];
+            });
+            return *this;
+        }
+        const basic_reference &operator=(const basic_reference &other) const { return *this = T(other); }
+
+        friend class basic_reference<true>;
+    };
+
+    template <bool Const> class basic_iterator {
+        using container = std::conditional_t<Const, const soa_vector, soa_vector>;
+        container *v = nullptr;
+        std::ptrdiff_t i = 0;
+
+      public:
+        using value_type = T;
+        using reference = basic_reference<Const>;
+        using pointer = void;
+        using difference_type = std::ptrdiff_t;
+        using iterator_category = std::random_access_iterator_tag; // with proxy references, like std::vector<bool>
+
+        basic_iterator() = default;
+        basic_iterator(container *v, std::ptrdiff_t i) : v(v), i(i) {}
+        basic_iterator(const basic_iterator<false> &other) : v(other.v), i(other.i) {}
+
+        inline reference operator*() const { return {v, std::size_t(i)}; }
+        inline reference operator[](difference_type d) const { return {v, std::size_t(i + d)}; }
+        inline basic_iterator &operator++() {
+            ++i;
+            return *this;
+        }
+        inline basic_iterator &operator--() {
+            --i;
+            return *this;
+        }
+        inline basic_iterator operator++(int) { return {v, i++}; }
+        inline basic_iterator operator--(int) { return {v, i--}; }
+        inline basic_iterator &operator+=(difference_type d) {
+            i += d;
+            return *this;
+        }
+        inline basic_iterator &operator-=(difference_type d) {
+            i -= d;
+            return *this;
+        }
+        inline basic_iterator operator+(difference_type d) const { return {v, i + d}; }
+        inline basic_iterator operator-(difference_type d) const { return {v, i - d}; }
+        friend inline basic_iterator operator+(difference_type d, const basic_iterator &it) { return it + d; }
+        inline difference_type operator-(const basic_iterator &other) const { return i - other.i; }
+        inline bool operator==(const basic_iterator &other) const { return i == other.i; }
+        inline bool operator!=(const basic_iterator &other) const { return i != other.i; }
+        inline bool operator<(const basic_iterator &other) const { return i < other.i; }
+        inline bool operator>(const basic_iterator &other) const { return i > other.i; }
+        inline bool operator<=(const basic_iterator &other) const { return i <= other.i; }
+        inline bool operator>=(const basic_iterator &other) const { return i >= other.i; }
+
+        friend class basic_iterator<true>;
+    };
+
+  public:
+    using value_type = T;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using reference = basic_reference<false>;
+    using const_reference = basic_reference<true>;
+    using iterator = basic_iterator<false>;
+    using const_iterator = basic_iterator<true>;
+
+    soa_vector() = default;
+    explicit soa_vector(size_type n) { resize(n); }
+    template <class Iter> soa_vector(Iter first, Iter last) {
+        reserve(std::distance(first, last));
+        for (; first != last; ++first)
+            push_back(*first);
+    }
+
+    size_type size() const { return n; }
+    size_type capacity() const { return n_max; }
+    bool empty() const { return n == 0; }
+
+    /** Reallocates all buffers; afterwards columns are `capacity()` elements apart */
+    void reserve(size_type new_capacity) {
+        if (new_capacity <= n_max)
+            return;
+        new_capacity = (new_capacity + padding - 1) / padding * padding;
+        for_each_member([&](auto member, auto &b) {
+            using traits = SoA::member_pointer_traits<decltype(member)>;
+            std::remove_reference_t<decltype(b)> resized(new_capacity * traits::size);
+            for (std::ptrdiff_t c = 0; c < traits::size; c++)
+                std::copy_n(b.begin() + c * n_max, n, resized.begin() + c * new_capacity);
+            b.swap(resized);
+        });
+        n_max = new_capacity;
+    }
+
+    void resize(size_type new_size) {
+        if (new_size > n_max)
+            reserve(std::max(new_size, 2 * n_max));
+        for (size_type i = n; i < new_size; i++) // new elements are value initialized
+            (*this)[i] = T{};
+        n = new_size;
+    }
+
+    void push_back(const T &value) {
+        if (n == n_max)
+            reserve(std::max<size_type>(padding, 2 * n_max));
+        (*this)[n++] = value;
+    }
+
+    void clear() { n = 0; }
+
+    reference operator[](size_type i) { return {this, i}; }
+    const_reference operator[](size_type i) const { return {this, i}; }
+
+    iterator begin() { return {this, 0}; }
+    iterator end() { return {this, difference_type(n)}; }
+    const_iterator begin() const { return {this, 0}; }
+    const_iterator end() const { return {this, difference_type(n)}; }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+
+    /** First element of the first column of data member `m` */
+    template <class M> auto *data(M T::*m) { return const_cast<typename SoA::member_traits<M>::scalar *>(find(m)); }
+    template <class M> const auto *data(M T::*m) const { return find(m); }
+};
+
+/**
+ * @brief Eigen::Map to a data member of a structure of arrays
+ *
+ * The map has `size()` rows and one column per scalar in the member;
+ * columns are contiguous and aligned, and `outerStride()` equals `capacity()`.
+ */
+template <class T, auto... Members, class M> auto asEigenMatrix(soa_vector<T, Members...> &v, M T::*m) {
+    using traits = SoA::member_traits<M>;
+    using Tarray = Eigen::Array<typename traits::scalar, Eigen::Dynamic, traits::size>;
+    return Eigen::Map<Tarray, Eigen::AlignedMax, Eigen::OuterStride<>>(v.data(m), v.size(), traits::size,
+                                                                        Eigen::OuterStride<>(v.capacity()));
+}
+
+template <class T, auto... Members, class M> auto asEigenMatrix(const soa_vector<T, Members...> &v, M T::*m) {
+    using traits = SoA::member_traits<M>;
+    using Tarray = Eigen::Array<typename traits::scalar, Eigen::Dynamic, traits::size>;
+    return Eigen::Map<const Tarray, Eigen::AlignedMax, Eigen::OuterStride<>>(v.data(m), v.size(), traits::size,
+                                                                              Eigen::OuterStride<>(v.capacity()));
+}
+
+/** @brief Contiguous, aligned Eigen::Map to a scalar data member of a structure of arrays */
+template <class T, auto... Members, class M> auto asEigenVector(soa_vector<T, Members...> &v, M T::*m) {
+    static_assert(std::is_arithmetic<M>::value, "member must be a scalar");
+    return Eigen::Map<Eigen::Array<M, Eigen::Dynamic, 1>, Eigen::AlignedMax>(v.data(m), v.size());
+}
+
+template <class T, auto... Members, class M> auto asEigenVector(const soa_vector<T, Members...> &v, M T::*m) {
+    static_assert(std::is_arithmetic<M>::value, "member must be a scalar");
+    return Eigen::Map<const Eigen::Array<M, Eigen::Dynamic, 1>, Eigen::AlignedMax>(v.data(m), v.size());
+}
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+#include "pairwise_iterator.h"
+
+namespace SoA {
+struct TestParticle {
+    Eigen::Vector3d pos = {0, 0, 0};
+    double charge = 0;
+    int id = 0; // not stored
+};
+} // namespace SoA
+
+TEST_CASE("soa_vector") {
+    using SoA::TestParticle;
+    using Tvector = soa_vector<TestParticle, &TestParticle::pos, &TestParticle::charge>;
+    Tvector v;
+    CHECK(v.empty());
+    for (int i = 0; i < 20; i++)
+        v.push_back({{double(i), 2.0 * i, 3.0 * i}, 0.5 * i, i});
+    CHECK(v.size() == 20);
+    CHECK(v.capacity() >= 20);
+
+    // gather and scatter
+    TestParticle p = v[3];
+    CHECK(p.pos.y() == doctest::Approx(6));
+    CHECK(p.charge == doctest::Approx(1.5));
+    CHECK(p.id == 0);
+    v[4] = p;
+    CHECK(v[4].get(&TestParticle::pos).x() == doctest::Approx(3));
+    v[5].get(&TestParticle::pos).z() = -1;
+    v[5].get(&TestParticle::charge) += 1;
+    CHECK(TestParticle(v[5]).pos.z() == doctest::Approx(-1));
+    CHECK(TestParticle(v[5]).charge == doctest::Approx(3.5));
+
+    // unit stride, aligned views
+    auto m = asEigenMatrix(v, &TestParticle::pos);
+    auto q = asEigenVector(v, &TestParticle::charge);
+    CHECK(m.rows() == 20);
+    CHECK(m.cols() == 3);
+    CHECK(m.innerStride() == 1);
+    CHECK(m.outerStride() == Eigen::Index(v.capacity()));
+    CHECK(q.size() == 20);
+    CHECK(m(5, 2) == doctest::Approx(-1));
+    CHECK(m.col(0).sum() == doctest::Approx(190 - 1));
+    for (int c = 0; c < 3; c++)
+        CHECK(reinterpret_cast<std::uintptr_t>(&m(0, c)) % std::max(1, EIGEN_MAX_ALIGN_BYTES) == 0);
+    m.col(0) += 1;
+    CHECK(v[0].get(&TestParticle::pos).x() == doctest::Approx(1));
+
+    // resizing keeps the data
+    v.reserve(1000);
+    CHECK(v.capacity() >= 1000);
+    CHECK(TestParticle(v[19]).pos.z() == doctest::Approx(57));
+    v.resize(25);
+    CHECK(TestParticle(v[24]).charge == 0);
+
+    // pair loops over proxy references
+    std::vector<TestParticle> aos(v.begin(), v.end());
+    double sum = 0, sum_aos = 0;
+    for (auto [a, b] : PairwiseIterator::internal_pairs(v))
+        sum += a.get(&TestParticle::charge) * (a.get(&TestParticle::pos) - b.get(&TestParticle::pos)).norm();
+    for (auto [a, b] : PairwiseIterator::internal_pairs(aos))
+        sum_aos += a.charge * (a.pos - b.pos).norm();
+    CHECK(sum == doctest::Approx(sum_aos));
+
+    const Tvector &cv = v;
+    auto q_const = asEigenVector(cv, &TestParticle::charge);
+    CHECK(q_const.sum() == doctest::Approx(asEigenVector(v, &TestParticle::charge).sum()));
+    CHECK(std::distance(cv.begin(), cv.end()) == 25);
+}
+#endif
@@ -1,14 +1,38 @@
 #pragma once
 
 #include <Eigen/Core>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
 #include <iterator>
+#include <stdexcept>
 #include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace EigenFacade {
+/** Scalar type of a data member: arithmetic, C array or a class with `value_type`, e.g. Eigen or `std::array` */
+template <class M, class = void> struct member_scalar { typedef std::remove_all_extents_t<M> type; };
+template <class M> struct member_scalar<M, std::void_t<typename M::value_type>> {
+    typedef typename M::value_type type;
+};
+
+/** Scalar type of the mapped data: `dbl`, or if void, deduced from the member `memberptr` of `T` */
+template <typename dbl, class T, class memberptr>
+using scalar_t = typename std::conditional_t<
+    std::is_void<dbl>::value,
+    member_scalar<std::remove_reference_t<decltype(std::declval<T &>().*std::declval<memberptr>())>>,
+    std::common_type<dbl>>::type;
+} // namespace EigenFacade
 
 /**
  * @brief Eigen::Map facade to data members in STL container
  *
  * No data is copied and modifications of the Eigen object
- * modifies the original container and vice versa.
+ * modifies the original container and vice versa. The scalar type is deduced
+ * from the member, which may be float, int etc. The remaining members may be of any type:
+ * the inner stride is `sizeof(T)` in units of the scalar. Use e.g.
+ * `asEigenMatrix<double>()` to map the data as another type of same size.
  *
  * Example:
  *
@@ -19,22 +43,174 @@
  *    std::vector<Particle> v(10);
  *    auto m1 = asEigenMatrix(v.begin, v.end(), &Particle::pos);    --> 10x3 maxtix view
  *    auto m2 = asEigenVector(v.begin, v.end(), &Particle::charge); --> 10x1 vector view
+ *
+ *    struct Atom {
+ *       Eigen::Vector3f pos;
+ *       int id;
+ *    };
+ *    std::vector<Atom> a(10);
+ *    auto m3 = asEigenMatrix(a.begin(), a.end(), &Atom::pos);      --> 10x3 float view, inner stride 4
  */
-template <typename dbl = double, class iter, class memberptr> auto asEigenMatrix(iter begin, iter end, memberptr m) {
+template <typename dbl = void, class iter, class memberptr> auto asEigenMatrix(iter begin, iter end, memberptr m) {
     typedef typename std::iterator_traits<iter>::value_type T;
-    static_assert(sizeof(T) % sizeof(dbl) == 0, "value_type size must multiples of double");
-    const size_t s = sizeof(T) / sizeof(dbl);
-    const size_t cols = sizeof(((T *)0)->*m) / sizeof(dbl);
-    typedef Eigen::Matrix<dbl, Eigen::Dynamic, cols> Tmatrix;
-    return Eigen::Map<Tmatrix, 0, Eigen::Stride<1, s>>((dbl *)&(*begin.*m), end - begin, cols).array();
+    typedef EigenFacade::scalar_t<dbl, T, memberptr> Tscalar;
+    static_assert(sizeof(T) % sizeof(Tscalar) == 0, "value_type size must be a multiple of the scalar size");
+    static_assert(sizeof(((T *)0)->*m) % sizeof(Tscalar) == 0, "member size must be a multiple of the scalar size");
+    const size_t s = sizeof(T) / sizeof(Tscalar);
+    const size_t cols = sizeof(((T *)0)->*m) / sizeof(Tscalar);
+    typedef Eigen::Matrix<Tscalar, Eigen::Dynamic, cols> Tmatrix;
+    return Eigen::Map<Tmatrix, 0, Eigen::Stride<1, s>>((Tscalar *)&(*begin.*m), end - begin, cols).array();
 }
 
-template <typename dbl = double, class iter, class memberptr> auto asEigenVector(iter begin, iter end, memberptr m) {
+template <typename dbl = void, class iter, class memberptr> auto asEigenVector(iter begin, iter end, memberptr m) {
+    typedef typename std::iterator_traits<iter>::value_type T;
+    typedef EigenFacade::scalar_t<dbl, T, memberptr> Tscalar;
+    static_assert(sizeof(Tscalar) == sizeof(((T *)0)->*m), "member must be a scalar");
+    return asEigenMatrix<Tscalar>(begin, end, m).col(0);
+}
+
+/**
+ * @brief Structure padded to a multiple of `Alignment` bytes, e.g. for use with `asAlignedEigenMatrix()`
+ *
+ * Data members of `T` are accessed as usual, also through member pointers like `&T::pos`.
+ *
+ *    std::vector<padded<Particle, 32>> v(10); // 32 instead of 24 bytes per particle
+ */
+template <class T, std::size_t Alignment = 16> struct alignas(Alignment) padded : T {
+    static_assert(Alignment > 0 and (Alignment & (Alignment - 1)) == 0, "alignment must be a power of two");
+    using T::T;
+    padded() = default;
+    padded(const T &other) : T(other) {}
+};
+
+/**
+ * @brief Aligned Eigen::Map facade with unit inner stride
+ *
+ * Like `asEigenMatrix()` but maps the member as a row major matrix with a compile-time
+ * outer stride so that Eigen can use packet (SIMD) loads along rows instead of a
+ * strided inner loop. This requires that the member is the only data in the
+ * structure, or that the structure size is a multiple of 16 bytes (see `padded`);
+ * otherwise compilation fails. If `alignof(T)` is at least 16, the map is declared aligned
+ * to it (up to 64 bytes). This holds if the member is the first in the structure; since the
+ * offset of a member is not a compile-time constant, it is checked in all builds and
+ * `std::invalid_argument` is thrown for a misaligned member. Use `padded` to raise the alignment.
+ *
+ *    std::vector<padded<Particle, 32>> v(10);
+ *    auto m = asAlignedEigenMatrix(v.begin(), v.end(), &Particle::pos); --> 10x3 aligned map, row stride 4
+ *    auto r2 = m.rowwise().squaredNorm();
+ */
+template <typename dbl = void, class iter, class memberptr>
+auto asAlignedEigenMatrix(iter begin, iter end, memberptr m) {
     typedef typename std::iterator_traits<iter>::value_type T;
-    static_assert(std::is_same<dbl &, decltype(((T *)0)->*m)>::value, "member must be a scalar");
-    return asEigenMatrix<dbl>(begin, end, m).col(0);
+    typedef EigenFacade::scalar_t<dbl, T, memberptr> Tscalar;
+    static_assert(sizeof(T) % sizeof(Tscalar) == 0, "value_type size must be a multiple of the scalar size");
+    constexpr int s = sizeof(T) / sizeof(Tscalar);
+    constexpr int cols = sizeof(((T *)0)->*m) / sizeof(Tscalar);
+    constexpr int alignment = alignof(T) >= 16 ? std::min<int>(alignof(T), 64) : Eigen::Unaligned;
+    static_assert(s == cols or sizeof(T) % 16 == 0, "member must be the only data or value_type padded to 16 bytes");
+    constexpr int options = cols == 1 ? Eigen::ColMajor : Eigen::RowMajor; // column vectors cannot be row major
+    typedef Eigen::Matrix<Tscalar, Eigen::Dynamic, cols, options> Tmatrix;
+    typedef Eigen::Stride<cols == 1 ? 0 : s, cols == 1 ? s : 1> Tstride; // row stride; unit stride along rows
+    Tscalar *data = begin == end ? nullptr : (Tscalar *)&(*begin.*m);
+    if (alignment != Eigen::Unaligned and reinterpret_cast<std::uintptr_t>(data) % alignment != 0)
+        throw std::invalid_argument("asAlignedEigenMatrix: member not aligned; is it the first in the structure?");
+    return Eigen::Map<Tmatrix, alignment, Tstride>(data, end - begin, cols).array();
 }
 
+namespace EigenFacade {
+/** Thread local pool of aligned scratch buffers, reused by `packed_view` across calls */
+template <typename Tscalar> class buffer_pool {
+  public:
+    typedef std::vector<Tscalar, Eigen::aligned_allocator<Tscalar>> buffer;
+
+    static buffer_pool &local() {
+        thread_local buffer_pool pool;
+        return pool;
+    }
+    /** Buffer of `n` elements; reuses a released buffer if available */
+    buffer acquire(std::size_t n) {
+        buffer b;
+        if (not released.empty()) {
+            b.swap(released.back());
+            released.pop_back();
+        }
+        b.resize(n);
+        return b;
+    }
+    void release(buffer &&b) { released.push_back(std::move(b)); }
+
+  private:
+    std::vector<buffer> released;
+};
+} // namespace EigenFacade
+
+/**
+ * @brief Contiguous, aligned copy of a data member with write-back
+ *
+ * Gathers a member into a dense `N x cols` column major matrix so that matrix products
+ * and other heavy linear algebra run at full speed instead of on the strided `asEigenMatrix()`
+ * view. The scratch buffer is taken from a thread local pool and returned on destruction,
+ * so repeated use, e.g. every simulation step, does not allocate.
+ *
+ * Non-const `matrix()` and `array()` mark the snapshot as written and changes are then scattered
+ * back to the container by `commit()` or at destruction, only if written; read-only views never
+ * write back. `commit()` clears the mark, so the container may be changed directly afterwards;
+ * to write through the view again, call `matrix()` or `array()` again rather than keeping a
+ * reference from before the commit. The container must not be resized while the view exists.
+ *
+ *    packed_view view(v.begin(), v.end(), &Particle::pos);
+ *    view.matrix() = view.matrix() * rotation.transpose(); // (N x 3) * (3 x 3)
+ *    view.commit();                                         // or at end of scope
+ */
+template <class iter, class memberptr, typename dbl = void> class packed_view {
+    typedef typename std::iterator_traits<iter>::value_type T;
+
+  public:
+    typedef EigenFacade::scalar_t<dbl, T, memberptr> Tscalar;
+    static constexpr int cols = sizeof(((T *)0)->*std::declval<memberptr>()) / sizeof(Tscalar);
+    typedef Eigen::Matrix<Tscalar, Eigen::Dynamic, cols> Tmatrix;
+    typedef Eigen::Map<Tmatrix, Eigen::AlignedMax> Tmap;
+
+    packed_view(iter begin, iter end, memberptr m)
+        : begin(begin), end(end), m(m), buffer(pool().acquire((end - begin) * cols)),
+          map(buffer.data(), end - begin, cols) {
+        map = asEigenMatrix<Tscalar>(begin, end, m).matrix(); // gather
+    }
+    packed_view(const packed_view &) = delete;
+    packed_view &operator=(const packed_view &) = delete;
+    ~packed_view() {
+        commit();
+        pool().release(std::move(buffer));
+    }
+
+    Tmap &matrix() {
+        written = true;
+        return map;
+    }
+    const Tmap &matrix() const { return map; }
+    auto array() { return matrix().array(); }
+    auto array() const { return matrix().array(); }
+
+    /** Scatter changes back to the container, if written; the snapshot then equals the container */
+    void commit() {
+        if (written)
+            asEigenMatrix<Tscalar>(begin, end, m) = map.array();
+        written = false;
+    }
+
+    /** True if a mutable map was handed out since construction or the last `commit()` */
+    bool dirty() const { return written; }
+
+  private:
+    static EigenFacade::buffer_pool<Tscalar> &pool() { return EigenFacade::buffer_pool<Tscalar>::local(); }
+
+    iter begin, end;
+    memberptr m;
+    typename EigenFacade::buffer_pool<Tscalar>::buffer buffer;
+    Tmap map;
+    bool written = false;
+};
+
 #ifdef DOCTEST_LIBRARY_INCLUDED
 TEST_CASE("asEigenMatrix") {
     struct Particle {
@@ -67,3 +243,143 @@ TEST_CASE("asEigenMatrix") {
 }
 #endif
 
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE("asAlignedEigenMatrix") {
+    struct Particle {
+        Eigen::Vector3d pos={0,0,0};
+        double charge=0;
+    };
+    std::vector<padded<Particle, 32>> v(5);
+    for (size_t i=0; i<v.size(); i++)
+        v[i].pos = {double(i), 1, 2};
+    auto m = asAlignedEigenMatrix(v.begin(), v.end(), &Particle::pos);
+    static_assert( decltype(m)::IsRowMajor );
+
+    using doctest::Approx;
+    CHECK( sizeof(v[0]) == 32 );
+    CHECK( m.rows()==5 );
+    CHECK( m.cols()==3 );
+    CHECK( m.innerStride()==1 );
+    CHECK( m.outerStride()==4 );
+    CHECK( m.rowwise().squaredNorm().sum() == Approx(0+1+4+9+16 + 5*5) );
+    m.row(3).y() = -1;
+    CHECK( v[3].pos.y() == Approx(-1) );
+    CHECK( (m - asEigenMatrix(v.begin(), v.end(), &Particle::pos)).abs().maxCoeff() == 0 );
+
+    // member is the only data: fully contiguous, also for scalars
+    struct Charge {
+        double q;
+    };
+    std::vector<Charge> q = {{1}, {2}, {3}};
+    auto mq = asAlignedEigenMatrix(q.begin(), q.end(), &Charge::q);
+    CHECK( mq.cols()==1 );
+    CHECK( mq.innerStride()==1 );
+    CHECK( mq.sum() == Approx(6) );
+
+    // aligned storage but the member is not first: rejected rather than mapped as aligned
+    struct Shifted {
+        double charge=0;
+        Eigen::Vector3d pos={0,0,0};
+    };
+    std::vector<padded<Shifted, 32>> shifted(5);
+    CHECK_THROWS_AS( asAlignedEigenMatrix(shifted.begin(), shifted.end(), &Shifted::pos), std::invalid_argument );
+    CHECK( asAlignedEigenMatrix(shifted.begin(), shifted.end(), &Shifted::charge).rows()==5 );
+    std::vector<padded<Shifted, 32>> none;
+    CHECK( asAlignedEigenMatrix(none.begin(), none.end(), &Shifted::pos).rows()==0 );
+}
+#endif
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE("asEigenMatrix_mixed") {
+    struct Atom {
+        Eigen::Vector3f pos={0,0,0};
+        int id=0;
+        float charge=0;
+    };
+    std::vector<Atom> v(4);
+    for (size_t i=0; i<v.size(); i++) {
+        v[i].pos = {float(i), 2.0f * i, 0.5f};
+        v[i].id = int(i) + 10;
+        v[i].charge = -1.0f * i;
+    }
+    auto m = asEigenMatrix(v.begin(), v.end(), &Atom::pos);
+    auto ids = asEigenVector(v.begin(), v.end(), &Atom::id);
+    auto q = asEigenVector(v.begin(), v.end(), &Atom::charge);
+    static_assert( std::is_same<decltype(m)::Scalar, float>::value );
+    static_assert( std::is_same<decltype(ids)::Scalar, int>::value );
+
+    using doctest::Approx;
+    CHECK( m.rows()==4 );
+    CHECK( m.cols()==3 );
+    CHECK( m.col(1).sum() == Approx(12) );
+    CHECK( ids.sum() == 46 );
+    CHECK( q.sum() == Approx(-6) );
+    m.col(2) *= 2;
+    CHECK( v[3].pos.z() == Approx(1) );
+
+    struct Mixed {
+        Eigen::Vector3f pos={1,2,3};
+        double mass=2;
+    };
+    std::vector<Mixed> w(3);
+    CHECK( asEigenMatrix(w.begin(), w.end(), &Mixed::pos).sum() == Approx(18) );
+    CHECK( asEigenVector(w.begin(), w.end(), &Mixed::mass).sum() == Approx(6) );
+}
+#endif
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE("packed_view") {
+    struct Particle {
+        Eigen::Vector3d pos={0,0,0};
+        double charge=0;
+    };
+    std::vector<Particle> v(5);
+    for (size_t i=0; i<v.size(); i++)
+        v[i].pos = {double(i), 1, 2};
+
+    using doctest::Approx;
+    const double *data = nullptr;
+    {
+        packed_view view(v.begin(), v.end(), &Particle::pos);
+        const auto &c = view;
+        CHECK( c.matrix().rows()==5 );
+        CHECK( c.matrix().cols()==3 );
+        CHECK( c.matrix().col(0).sum() == Approx(10) );
+        CHECK( not view.dirty() );
+        v[0].pos.y() = -1; // read-only views do not write back
+        data = c.matrix().data();
+    }
+    CHECK( v[0].pos.y() == Approx(-1) );
+    {
+        packed_view view(v.begin(), v.end(), &Particle::pos);
+        CHECK( view.matrix().data() == data ); // buffer is reused
+        Eigen::Matrix3d scale = Eigen::Vector3d(2, 3, 4).asDiagonal();
+        view.matrix() = view.matrix() * scale;
+        CHECK( view.dirty() );
+        CHECK( v[4].pos.x() == Approx(4) );
+        view.commit();
+        CHECK( v[4].pos.x() == Approx(8) );
+        view.array().col(2) += 1;
+    }
+    CHECK( v[1].pos.z() == Approx(9) );
+    CHECK( v[1].charge == 0 );
+    {
+        packed_view view(v.begin(), v.end(), &Particle::pos);
+        view.matrix()(3, 1) = 7;
+        view.commit();
+        CHECK( v[3].pos.y() == Approx(7) );
+        CHECK( not view.dirty() );
+        v[3].pos.y() = 8; // changed directly after the commit
+    }
+    CHECK( v[3].pos.y() == Approx(8) ); // not overwritten by the snapshot at destruction
+    {
+        packed_view view(v.begin(), v.end(), &Particle::pos);
+        view.matrix()(3, 1) = 7;
+        view.commit();
+        view.matrix()(3, 1) = 9; // writing again marks the view again
+        CHECK( view.dirty() );
+    }
+    CHECK( v[3].pos.y() == Approx(9) );
+}
+#endif
@@ -0,0 +1,258 @@
+/*
+ *  Copyright (C) 2020-present  Mikael Lund (github.com/mlund/cpptricks)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <tuple>
+#include <utility>
+
+namespace PairwiseIterator {
+
+/**
+ * @brief Cartesian product of two chunked data sets that need not fit in memory
+ *
+ * A chunk provider is any object with `std::size_t chunk_count() const` and `load(k) const`
+ * returning chunk `k` as a container, e.g. by reading a block of frames from a file.
+ * The product visits chunk pairs in a blocked loop with chunks of the first set outermost,
+ * so each of its chunks is loaded once while the second set is streamed past it. While
+ * the pairs of one chunk pair are visited, the next chunk is loaded on a background thread,
+ * hiding I/O behind compute; at most two chunks of each set are in memory at a time.
+ * If the second set has a single chunk, it is loaded only once.
+ *
+ * The view is single pass, iterated with an input iterator yielding tuples of const references
+ * like `cartesian_product`, but in blocked order. Exceptions thrown by `load()` are rethrown
+ * from the iterator. The providers are held by value, and `load()` must tolerate being called
+ * from another thread.
+ *
+ * Example:
+ *
+ * ~~~ cpp
+ * struct frames {
+ *     std::string filename;
+ *     std::size_t chunk_count() const;
+ *     std::vector<Frame> load(std::size_t k) const; // read frames [k * 1000, (k + 1) * 1000)
+ * };
+ * for (auto [a, b] : streaming_cartesian_product(frames{"a.xtc"}, frames{"b.xtc"}))
+ *     correlation += overlap(a, b);
+ * ~~~
+ */
+template <class First, class Second> class streaming_product {
+    using chunk1 = decltype(std::declval<const First &>().load(std::size_t(0)));
+    using chunk2 = decltype(std::declval<const Second &>().load(std::size_t(0)));
+    using element1 = typename chunk1::value_type;
+    using element2 = typename chunk2::value_type;
+
+    /** Chunks loaded for one step of the blocked loop; empty if unchanged */
+    struct step {
+        std::optional<chunk1> x;
+        std::optional<chunk2> y;
+    };
+
+    /** Kept on the heap so that the view can move while the loader refers to it */
+    struct state {
+        First first;
+        Second second;
+        std::size_t steps = 0, current = 0; // chunk pairs in total; index of the next one to visit
+        chunk1 x;                           // resident chunks
+        chunk2 y;
+        std::future<step> pending; // next step, being loaded
+
+        state(First first, Second second)
+            : first(std::move(first)), second(std::move(second)),
+              steps(this->first.chunk_count() * this->second.chunk_count()) {}
+        ~state() {
+            if (pending.valid())
+                pending.wait();
+        }
+        void prefetch() {
+            if (current == steps)
+                return;
+            const std::size_t n2 = second.chunk_count(), a = current / n2, b = current % n2;
+            const bool load_x = b == 0, load_y = n2 > 1 or a == 0;
+            pending = std::async(std::launch::async, [this, a, b, load_x, load_y] {
+                step s;
+                if (load_x)
+                    s.x.emplace(first.load(a));
+                if (load_y)
+                    s.y.emplace(second.load(b));
+                return s;
+            });
+        }
+        /** Install the pending step and start loading the next; false when done */
+        bool next_step() {
+            while (current < steps) {
+                step s = pending.get();
+                if (s.x)
+                    x = std::move(*s.x);
+                if (s.y)
+                    y = std::move(*s.y);
+                current++;
+                prefetch();
+                if (not x.empty() and not y.empty())
+                    return true;
+            }
+            return false;
+        }
+    };
+    std::unique_ptr<state> data;
+
+  public:
+    class iterator {
+        state *s = nullptr; // null at the end
+        typename chunk1::const_iterator i;
+        typename chunk2::const_iterator j;
+
+        void next_step() {
+            if (s->next_step()) {
+                i = s->x.cbegin();
+                j = s->y.cbegin();
+            } else
+                s = nullptr;
+        }
+
+      public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = std::tuple<const element1 &, const element2 &>;
+        using reference = value_type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+
+        iterator() = default;
+        explicit iterator(state *s) : s(s) { next_step(); }
+        inline value_type operator*() const { return {*i, *j}; }
+        iterator &operator++() {
+            if (++j == s->y.cend()) {
+                j = s->y.cbegin();
+                if (++i == s->x.cend())
+                    next_step();
+            }
+            return *this;
+        }
+        inline bool operator==(const iterator &other) const {
+            return s == other.s and (s == nullptr or (i == other.i and j == other.j));
+        }
+        inline bool operator!=(const iterator &other) const { return not operator==(other); }
+    };
+
+    streaming_product(First first, Second second)
+        : data(std::make_unique<state>(std::move(first), std::move(second))) {}
+
+    /** Start loading; can be called once */
+    iterator begin() {
+        data->prefetch();
+        return iterator(data.get());
+    }
+    iterator end() { return iterator(); }
+};
+
+/** Streaming cartesian product of two chunk providers; see `streaming_product` */
+template <class First, class Second>
+streaming_product<First, Second> streaming_cartesian_product(First first, Second second) {
+    return streaming_product<First, Second>(std::move(first), std::move(second));
+}
+
+} // namespace PairwiseIterator
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+#include <atomic>
+#include <chrono>
+#include <numeric>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+TEST_CASE("streaming_product") {
+    using namespace PairwiseIterator;
+    struct provider {
+        std::vector<int> data;
+        std::size_t chunk_size;
+        std::shared_ptr<std::atomic<int>> loads = std::make_shared<std::atomic<int>>(0);
+        std::size_t chunk_count() const { return (data.size() + chunk_size - 1) / chunk_size; }
+        std::vector<int> load(std::size_t k) const {
+            (*loads)++;
+            if (data.at(k * chunk_size) < 0)
+                throw std::runtime_error("bad chunk");
+            auto last = std::min(data.size(), (k + 1) * chunk_size);
+            return std::vector<int>(data.begin() + k * chunk_size, data.begin() + last);
+        }
+    };
+    std::vector<int> a(23), b(17);
+    std::iota(a.begin(), a.end(), 0);
+    std::iota(b.begin(), b.end(), 100);
+    std::set<std::pair<int, int>> expected;
+    for (int i : a)
+        for (int j : b)
+            expected.emplace(i, j);
+
+    SUBCASE("several chunks") {
+        provider p1{a, 5}, p2{b, 4};
+        auto product = streaming_cartesian_product(p1, p2);
+        std::set<std::pair<int, int>> visited;
+        std::size_t cnt = 0;
+        for (auto [i, j] : product) {
+            visited.emplace(i, j);
+            cnt++;
+        }
+        CHECK(cnt == expected.size());
+        CHECK(visited == expected);
+        CHECK(*p1.loads == 5);      // each chunk of the first set once
+        CHECK(*p2.loads == 5 * 5); // the second set once per chunk of the first
+    }
+    SUBCASE("single resident chunk") {
+        provider p1{a, 10}, p2{b, 100};
+        std::size_t cnt = 0;
+        auto product = streaming_cartesian_product(p1, p2);
+        for (auto it = product.begin(); it != product.end(); ++it)
+            cnt++;
+        CHECK(cnt == expected.size());
+        CHECK(*p2.loads == 1);
+    }
+    SUBCASE("loading overlaps compute") {
+        provider p1{a, 12}, p2{b, 9}; // 2 x 2 chunk pairs of up to 108 pairs
+        auto loads_started = [&] { return *p1.loads + *p2.loads; };
+        bool overlapped = false;
+        std::size_t cnt = 0;
+        for (auto pair : streaming_cartesian_product(p1, p2)) {
+            (void)pair;
+            if (cnt++ == 0) { // still in the first chunk pair: the second must be loading already
+                auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+                while (loads_started() < 3 and std::chrono::steady_clock::now() < deadline)
+                    std::this_thread::yield();
+                overlapped = loads_started() == 3; // x0 and y0, then y1 in the background
+            }
+        }
+        CHECK(overlapped);
+        CHECK(cnt == expected.size());
+    }
+    SUBCASE("errors") {
+        auto bad = a;
+        bad[15] = -1; // fourth chunk fails to load
+        provider p1{bad, 5}, p2{b, 4};
+        auto product = streaming_cartesian_product(p1, p2);
+        auto consume = [&] {
+            for (auto pair : product)
+                (void)pair;
+        };
+        CHECK_THROWS_AS(consume(), std::runtime_error);
+    }
+}
+#endif
@@ -10,12 +10,28 @@
 #include <vector>
 #include <list>
 #include <array>
+#include <atomic>
 #include <set>
 #include <numeric>
+#include <random>
 #include <cmath>
 #include <range/v3/all.hpp>
+#include <Eigen/Core>
 
 #include "pairwise_iterator.h"
 #include "invsqrt.h"
 #include "stl_eigen_facade.h"
+#include "verlet_list.h"
+#include "masked_pairs.h"
+#include "soa_vector.h"
+#include "arena.h"
+#include "work_stealing.h"
+#include "instrumentation.h"
+#include "pbc_distance.h"
+#include "pair_list.h"
+#include "pair_table.h"
+#include "pair_pipeline.h"
+#include "streaming_product.h"
+#include "offload.h"
+#include "mpi_pairs.h"
 
@@ -0,0 +1,220 @@
+/*
+ *  Copyright (C) 2020-present  Mikael Lund (github.com/mlund/cpptricks)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include "pairwise_iterator.h"
+#include "stl_eigen_facade.h"
+#include <Eigen/Core>
+#include <utility>
+#include <vector>
+
+namespace PairwiseIterator {
+
+/**
+ * @brief Persistent Verlet neighbor list with skin
+ *
+ * Stores all pairs closer than `cutoff + skin` using a `cutoff_pairs` cell list search.
+ * The list remains valid, i.e. contains all pairs within `cutoff`, as long as no particle
+ * has moved more than half the skin since it was built. `update()` checks this using the
+ * `asEigenMatrix` facade and rebuilds only when needed, amortizing the search over many steps.
+ *
+ * Iterating yields tuples of (const) references to candidate pairs, just as `internal_pairs`.
+ * Pairs may be further apart than the cutoff and should be tested in the loop body.
+ * The iterator is random access so the list can be given to `parallel_for_pairs`.
+ *
+ * Example:
+ *
+ * ~~~ cpp
+ * verlet_list list(v, &Particle::pos, box, 2.5, 0.3);
+ * for (int step = 0; step < steps; step++) {
+ *     list.update(); // rebuild only if needed
+ *     for (auto [i,j] : list)
+ *         ...
+ *     move(v);
+ * }
+ * ~~~
+ *
+ * @note Positions must be stored as doubles
+ */
+template <class T, class Member, class Box, bool Const = std::is_const<T>::value> class verlet_list {
+  private:
+    using iter = typename std::conditional<Const, typename T::const_iterator, typename T::iterator>::type;
+    using reference = typename std::conditional<Const, typename T::const_reference, typename T::reference>::type;
+    using index_pair = std::pair<std::size_t, std::size_t>;
+
+    T &vec;
+    Member member;
+    Box box;
+    double cutoff, skin;
+    std::vector<index_pair> pairs;                           // candidate pairs within cutoff + skin
+    Eigen::Array<double, Eigen::Dynamic, 3> last_positions; // positions at last rebuild
+    std::size_t _rebuilds = 0;
+
+    auto positions() const { return asEigenMatrix(vec.begin(), vec.end(), member); }
+
+  public:
+    struct iterator {
+        using iterator_category = std::random_access_iterator_tag;
+        using reference = verlet_list::reference;
+        using value_type = std::tuple<reference, reference>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+
+        iter first;
+        typename std::vector<index_pair>::const_iterator pair;
+
+        iterator() = default;
+        iterator(iter first, typename std::vector<index_pair>::const_iterator pair) : first(first), pair(pair) {}
+        inline value_type operator*() const { return {first[pair->first], first[pair->second]}; }
+        inline value_type operator[](difference_type d) const { return *(*this + d); }
+        inline iterator &operator++() {
+            ++pair;
+            return *this;
+        }
+        inline iterator &operator--() {
+            --pair;
+            return *this;
+        }
+        inline iterator operator++(int) { return iterator(first, pair++); }
+        inline iterator operator--(int) { return iterator(first, pair--); }
+        inline iterator &operator+=(difference_type d) {
+            pair += d;
+            return *this;
+        }
+        inline iterator &operator-=(difference_type d) { return *this += -d; }
+        inline iterator operator+(difference_type d) const { return iterator(first, pair + d); }
+        inline iterator operator-(difference_type d) const { return iterator(first, pair - d); }
+        friend inline iterator operator+(difference_type d, const iterator &it) { return it + d; }
+        inline difference_type operator-(const iterator &other) const { return pair - other.pair; }
+        inline bool operator==(const iterator &other) const { return pair == other.pair; }
+        inline bool operator!=(const iterator &other) const { return pair != other.pair; }
+        inline bool operator<(const iterator &other) const { return pair < other.pair; }
+        inline bool operator>(const iterator &other) const { return pair > other.pair; }
+        inline bool operator<=(const iterator &other) const { return pair <= other.pair; }
+        inline bool operator>=(const iterator &other) const { return pair >= other.pair; }
+        /** Container indices of the current pair */
+        inline const index_pair &indices() const { return *pair; }
+    };
+
+    verlet_list(T &vec, Member member, const Box &box, double cutoff, double skin)
+        : vec(vec), member(member), box(box), cutoff(cutoff), skin(skin) {
+        rebuild();
+    }
+
+    /** Search for all pairs within cutoff + skin */
+    void rebuild() {
+        cutoff_pairs<T, Member, Box, Const> search(vec, member, box, cutoff + skin);
+        pairs.clear();
+        for (auto it = search.begin(); it != search.end(); ++it)
+            pairs.push_back(it.indices());
+        last_positions = positions();
+        _rebuilds++;
+    }
+
+    /** True if a particle has moved more than half the skin (minimum image) or if particles were added/removed */
+    bool needs_rebuild() const {
+        if (last_positions.rows() != static_cast<Eigen::Index>(vec.size()))
+            return true;
+        Eigen::Array<double, Eigen::Dynamic, 3> displacement = positions() - last_positions;
+        for (Eigen::Index d = 0; d < 3; d++)
+            displacement.col(d) -= box[d] * (displacement.col(d) / box[d]).round();
+        return vec.size() > 0 and displacement.matrix().rowwise().squaredNorm().maxCoeff() > 0.25 * skin * skin;
+    }
+
+    /** Rebuild the list if needed; returns true if rebuilt */
+    bool update() {
+        if (not needs_rebuild())
+            return false;
+        rebuild();
+        return true;
+    }
+
+    std::size_t rebuilds() const { return _rebuilds; } // number of times the list has been built
+    std::size_t size() const { return pairs.size(); }  // number of candidate pairs
+    iterator begin() const { return iterator(vec.begin(), pairs.begin()); }
+    iterator end() const { return iterator(vec.begin(), pairs.end()); }
+};
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE("verlet_list") {
+    struct Particle {
+        Eigen::Vector3d pos = {0, 0, 0};
+        double charge = 0;
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    };
+    std::mt19937 engine;
+    std::uniform_real_distribution<double> random(0.0, 1.0);
+    Eigen::Vector3d box = {8, 8, 8};
+    double cutoff = 1.5, skin = 0.4;
+    std::vector<Particle> v(300);
+    for (auto &p : v)
+        p.pos = box.cwiseProduct(Eigen::Vector3d(random(engine), random(engine), random(engine)));
+
+    // all pairs within the cutoff must be in the list
+    auto complete = [&](const auto &list) {
+        auto sorted = [](std::pair<std::size_t, std::size_t> ij) {
+            return std::pair(std::min(ij.first, ij.second), std::max(ij.first, ij.second));
+        };
+        std::set<std::pair<std::size_t, std::size_t>> candidates;
+        for (auto it = list.begin(); it != list.end(); ++it)
+            candidates.insert(sorted(it.indices()));
+        cutoff_pairs pairs(v, &Particle::pos, box, cutoff);
+        for (auto it = pairs.begin(); it != pairs.end(); ++it)
+            if (candidates.count(sorted(it.indices())) == 0)
+                return false;
+        return true;
+    };
+
+    verlet_list list(v, &Particle::pos, box, cutoff, skin);
+    cutoff_pairs pairs(v, &Particle::pos, box, cutoff + skin);
+    CHECK(list.rebuilds() == 1);
+    CHECK(list.size() == std::size_t(std::distance(pairs.begin(), pairs.end())));
+    CHECK(std::size_t(list.end() - list.begin()) == list.size());
+    CHECK(complete(list));
+
+    // small displacements, also across the periodic boundary, keep the list
+    for (auto &p : v) {
+        p.pos += 0.19 * Eigen::Vector3d(random(engine), random(engine), random(engine)).normalized();
+        for (int d = 0; d < 3; d++)
+            p.pos[d] -= box[d] * std::floor(p.pos[d] / box[d]);
+    }
+    CHECK(list.update() == false);
+    CHECK(list.rebuilds() == 1);
+    CHECK(complete(list));
+
+    // larger displacement triggers a rebuild
+    v[10].pos.x() += 0.21;
+    CHECK(list.update() == true);
+    CHECK(list.rebuilds() == 2);
+    CHECK(complete(list));
+
+    // modify through references
+    for (auto [i, j] : list)
+        i.charge = j.charge = 1;
+    CHECK(std::count_if(v.begin(), v.end(), [](auto &p) { return p.charge == 1; }) > 0);
+
+    auto cnt = parallel_reduce_pairs(std::execution::par, list, std::size_t(0), std::plus<>(), [&](auto pair) {
+        auto [i, j] = pair;
+        Eigen::Vector3d d = i.pos - j.pos;
+        for (int k = 0; k < 3; k++)
+            d[k] -= box[k] * std::round(d[k] / box[k]);
+        return std::size_t(d.norm() < cutoff + skin);
+    });
+    CHECK(cnt == list.size());
+}
+#endif
+
+} // namespace PairwiseIterator
@@ -0,0 +1,378 @@
+/*
+ *  Copyright (C) 2020-present  Mikael Lund (github.com/mlund/cpptricks)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace WorkStealing {
+
+/** Half-open index range [first, second) */
+using index_range = std::pair<std::size_t, std::size_t>;
+
+/**
+ * @brief Chase-Lev work-stealing deque of index ranges
+ *
+ * The owning thread pushes and pops at the bottom while any other thread may steal from
+ * the top, all without locks. Follows Lê et al., "Correct and efficient work-stealing for
+ * weak memory models" (PPoPP 2013). The two halves of a range are separate atomics; a torn
+ * read is harmless since the slot can only change after `top` has moved, which makes the
+ * thief's compare-exchange fail. When full, the ring buffer doubles and the old one is kept
+ * alive until destruction as thieves may still be reading from it.
+ */
+class chase_lev_deque {
+    struct ring {
+        std::size_t mask;
+        std::unique_ptr<std::atomic<std::size_t>[]> first, second;
+        explicit ring(std::size_t size)
+            : mask(size - 1), first(new std::atomic<std::size_t>[size]), second(new std::atomic<std::size_t>[size]) {}
+        void put(std::ptrdiff_t k, index_range r) {
+            first[k & mask].store(r.first, std::memory_order_relaxed);
+            second[k & mask].store(r.second, std::memory_order_relaxed);
+        }
+        index_range get(std::ptrdiff_t k) const {
+            return {first[k & mask].load(std::memory_order_relaxed), second[k & mask].load(std::memory_order_relaxed)};
+        }
+    };
+    alignas(64) std::atomic<std::ptrdiff_t> top{0};
+    alignas(64) std::atomic<std::ptrdiff_t> bottom{0};
+    std::atomic<ring *> buffer;
+    std::vector<std::unique_ptr<ring>> rings; // current and retired buffers, owned by the owner thread
+
+  public:
+    explicit chase_lev_deque(std::size_t capacity = 64) {
+        std::size_t size = 1;
+        while (size < capacity)
+            size *= 2;
+        rings.push_back(std::make_unique<ring>(size));
+        buffer.store(rings.back().get(), std::memory_order_relaxed);
+    }
+    chase_lev_deque(const chase_lev_deque &) = delete;
+    chase_lev_deque &operator=(const chase_lev_deque &) = delete;
+
+    /** Add range at the bottom; owner only */
+    void push(index_range r) {
+        auto b = bottom.load(std::memory_order_relaxed);
+        auto t = top.load(std::memory_order_acquire);
+        auto a = buffer.load(std::memory_order_relaxed);
+        if (b - t > static_cast<std::ptrdiff_t>(a->mask)) { // full
+            rings.push_back(std::make_unique<ring>(2 * (a->mask + 1)));
+            for (auto k = t; k < b; k++)
+                rings.back()->put(k, a->get(k));
+            a = rings.back().get();
+            buffer.store(a, std::memory_order_release);
+        }
+        a->put(b, r);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    /** Take the most recently pushed range; owner only */
+    std::optional<index_range> pop() {
+        auto b = bottom.load(std::memory_order_relaxed) - 1;
+        auto a = buffer.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto t = top.load(std::memory_order_relaxed);
+        std::optional<index_range> r;
+        if (t <= b) {
+            r = a->get(b);
+            if (t == b) { // last element; race against thieves
+                if (not top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                    r.reset();
+                bottom.store(b + 1, std::memory_order_relaxed);
+            }
+        } else
+            bottom.store(b + 1, std::memory_order_relaxed);
+        return r;
+    }
+
+    /** Take the oldest range; any thread */
+    std::optional<index_range> steal() {
+        auto t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto b = bottom.load(std::memory_order_acquire);
+        if (t < b) {
+            auto r = buffer.load(std::memory_order_acquire)->get(t);
+            if (top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                return r;
+        }
+        return std::nullopt;
+    }
+
+    bool empty() const { return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed); }
+};
+
+/**
+ * @brief Pool of worker threads running `parallel_for` loops by work stealing
+ *
+ * The calling thread takes part as one of the workers and owns the deque that initially holds the
+ * whole index range. Whoever holds a range larger than the grain size splits it in half, pushes
+ * one half onto its own deque and continues with the other, so idle workers steal large ranges
+ * first and splitting only happens where there are idle workers to take the pieces. This adapts
+ * to loops where the cost per index varies a lot, such as pairs within a cutoff in a system with
+ * dense clusters and empty regions. Workers sleep between loops.
+ *
+ * Loops are run one at a time; a `parallel_for` called from inside a loop body of the same pool
+ * runs serially in the calling worker. The first exception thrown by the body is rethrown in the
+ * caller once all indices are done.
+ *
+ * Example:
+ *
+ * ~~~ cpp
+ * WorkStealing::pool pool(8);
+ * pool.parallel_for(0, n, 16, [&](std::size_t first, std::size_t last) {
+ *     for (auto i = first; i < last; i++)
+ *         ...
+ * });
+ * ~~~
+ */
+class pool {
+    struct worker {
+        chase_lev_deque deque;
+        unsigned seed; // for choosing victims
+        explicit worker(unsigned seed) : seed(seed) {}
+    };
+    std::vector<std::unique_ptr<worker>> workers; // last one belongs to the caller of `parallel_for`
+    std::vector<std::thread> threads;
+
+    std::mutex loop_mutex; // one loop at a time
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    std::size_t epoch = 0; // incremented for each loop; guarded by sleep_mutex
+    bool stop = false;     // guarded by sleep_mutex
+
+    // current loop
+    void (*invoke)(void *, std::size_t, std::size_t) = nullptr;
+    void *body = nullptr;
+    std::size_t grain = 1;
+    std::atomic<std::size_t> remaining{0}; // indices not yet processed
+    std::atomic<bool> failed{false};
+    std::exception_ptr exception;
+
+    static pool *&current() {
+        thread_local pool *p = nullptr;
+        return p;
+    }
+
+    std::optional<index_range> find_work(worker &self) {
+        if (auto r = self.deque.pop())
+            return r;
+        const auto n = workers.size();
+        for (std::size_t attempt = 0; attempt < 2 * n; attempt++) {
+            self.seed = self.seed * 1103515245u + 12345u;
+            auto &victim = *workers[(self.seed >> 16) % n];
+            if (&victim != &self)
+                if (auto r = victim.deque.steal())
+                    return r;
+        }
+        return std::nullopt;
+    }
+
+    void run(worker &self, index_range r) {
+        while (r.second - r.first > grain) { // keep one half, offer the other to thieves
+            auto middle = r.first + (r.second - r.first) / 2;
+            self.deque.push({middle, r.second});
+            r.second = middle;
+        }
+        if (not failed.load(std::memory_order_relaxed)) {
+            try {
+                invoke(body, r.first, r.second);
+            } catch (...) {
+                if (not failed.exchange(true))
+                    exception = std::current_exception();
+            }
+        }
+        remaining.fetch_sub(r.second - r.first, std::memory_order_acq_rel);
+    }
+
+    /** Process ranges until the current loop has no indices left */
+    void work(worker &self) {
+        while (remaining.load(std::memory_order_acquire) > 0) {
+            if (auto r = find_work(self))
+                run(self, *r);
+            else
+                std::this_thread::yield();
+        }
+    }
+
+    void thread_main(std::size_t index) {
+        current() = this;
+        std::size_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(sleep_mutex);
+                wake.wait(lock, [&] { return stop or epoch != seen; });
+                if (stop)
+                    return;
+                seen = epoch;
+            }
+            work(*workers[index]);
+        }
+    }
+
+  public:
+    /** Create a pool with `size` workers including the calling thread, i.e. `size - 1` threads */
+    explicit pool(std::size_t size = std::max(1u, std::thread::hardware_concurrency())) {
+        size = std::max<std::size_t>(size, 1);
+        for (std::size_t i = 0; i < size; i++)
+            workers.push_back(std::make_unique<worker>(static_cast<unsigned>(i + 1)));
+        for (std::size_t i = 0; i + 1 < size; i++)
+            threads.emplace_back(&pool::thread_main, this, i);
+    }
+    pool(const pool &) = delete;
+    pool &operator=(const pool &) = delete;
+    ~pool() {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            stop = true;
+        }
+        wake.notify_all();
+        for (auto &t : threads)
+            t.join();
+    }
+
+    /** Number of workers, including the thread calling `parallel_for()` */
+    std::size_t size() const { return workers.size(); }
+
+    /**
+     * @brief Call `fn(begin, end)` on disjoint sub-ranges covering [first, last)
+     * @param grain Ranges are not split below this size; larger values lower the scheduling
+     *              overhead, smaller values give better balance
+     */
+    template <class Function> void parallel_for(std::size_t first, std::size_t last, std::size_t grain, Function fn) {
+        if (first >= last)
+            return;
+        if (current() == this or workers.size() == 1) { // nested or no threads
+            fn(first, last);
+            return;
+        }
+        std::lock_guard<std::mutex> loop_lock(loop_mutex);
+        auto &self = *workers.back();
+        invoke = [](void *body, std::size_t first, std::size_t last) { (*static_cast<Function *>(body))(first, last); };
+        body = &fn;
+        this->grain = std::max<std::size_t>(grain, 1);
+        failed = false;
+        exception = nullptr;
+        remaining.store(last - first, std::memory_order_release);
+        self.deque.push({first, last});
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            epoch++;
+        }
+        wake.notify_all();
+        current() = this;
+        work(self);
+        current() = nullptr;
+        if (exception)
+            std::rethrow_exception(exception);
+    }
+
+    /** Pool shared by the process, with one worker per hardware thread */
+    static pool &global() {
+        static pool p;
+        return p;
+    }
+};
+
+} // namespace WorkStealing
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+#include <numeric>
+#include <stdexcept>
+
+TEST_CASE("chase_lev_deque") {
+    using WorkStealing::index_range;
+    WorkStealing::chase_lev_deque deque(2);
+    CHECK(deque.empty());
+    CHECK(not deque.pop());
+    for (std::size_t i = 0; i < 100; i++) // grows beyond the initial capacity
+        deque.push({i, i + 1});
+    CHECK(deque.steal() == index_range{0, 1}); // oldest from the top
+    CHECK(deque.pop() == index_range{99, 100}); // newest from the bottom
+
+    std::atomic<std::size_t> stolen = 0, popped = 0;
+    std::vector<std::thread> thieves;
+    for (int t = 0; t < 3; t++)
+        thieves.emplace_back([&] {
+            while (not deque.empty())
+                if (auto r = deque.steal())
+                    stolen += r->first;
+        });
+    while (auto r = deque.pop())
+        popped += r->first;
+    for (auto &t : thieves)
+        t.join();
+    CHECK(stolen + popped == 99 * 100 / 2 - 99); // indices 1..98, each taken exactly once
+}
+
+TEST_CASE("work_stealing_pool") {
+    WorkStealing::pool pool(4);
+    CHECK(pool.size() == 4);
+    std::vector<std::atomic<int>> hits(10000);
+    for (std::size_t grain : {1, 7, 100000}) {
+        for (auto &h : hits)
+            h = 0;
+        std::atomic<std::size_t> largest = 0;
+        pool.parallel_for(0, hits.size(), grain, [&](std::size_t first, std::size_t last) {
+            for (auto i = first; i < last; i++)
+                hits[i]++;
+            for (auto l = largest.load(); l < last - first and not largest.compare_exchange_weak(l, last - first);)
+                ;
+        });
+        CHECK(largest <= grain);
+        CHECK(std::all_of(hits.begin(), hits.end(), [](auto &h) { return h == 1; }));
+    }
+
+    SUBCASE("irregular work") {
+        std::atomic<std::size_t> sum = 0, work = 0;
+        pool.parallel_for(0, 1000, 1, [&](std::size_t first, std::size_t) {
+            std::size_t s = 0;
+            for (std::size_t k = 0; k < first * first; k++) // cost grows with the index
+                s += k % 2;
+            sum += first;
+            work += s;
+        });
+        CHECK(sum == 1000 * 999 / 2);
+        CHECK(work > 0);
+    }
+
+    SUBCASE("nested loops and exceptions") {
+        std::atomic<int> count = 0;
+        pool.parallel_for(0, 8, 1, [&](std::size_t, std::size_t) {
+            pool.parallel_for(0, 10, 1, [&](std::size_t first, std::size_t last) { count += last - first; });
+        });
+        CHECK(count == 80);
+        CHECK_THROWS_AS(pool.parallel_for(0, 100, 1,
+                                          [](std::size_t first, std::size_t) {
+                                              if (first == 42)
+                                                  throw std::runtime_error("fail");
+                                          }),
+                        std::runtime_error);
+        pool.parallel_for(0, 10, 1, [&](std::size_t first, std::size_t last) { count += last - first; });
+        CHECK(count == 90); // still usable
+    }
+}
+#endif